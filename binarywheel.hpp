@@ -4,289 +4,2432 @@
 #include <utility>
 #include <functional>
 #include <string>
+#include <string_view>
 #include <cstring>
 #include <cassert>
 #include <tuple>
+#include <array>
 #include <vector>
+#include <memory_resource>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 #include <optional>
+#include <unordered_map>
+#include <deque>
 #include <variant>
 #include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <istream>
+#include <ostream>
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#endif
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 namespace bw
 {
 	template<typename T> struct Type;
 
-	struct Reader
+	// Types with no variable-length parts have the same encoded length for every value, known at
+	// compile time: fixedBytes whole bytes plus fixedBits bits going to bit groups.
+	constexpr size_t variable = std::numeric_limits<size_t>::max();
+	template<typename T> constexpr size_t fixedBytes = Type<std::decay_t<T>>::fixedBytes;
+	template<typename T> constexpr size_t fixedBits = Type<std::decay_t<T>>::fixedBits;
+	template<typename T> constexpr bool isFixed = fixedBytes<T> != variable;
+	template<typename T> constexpr size_t fixedBitLength = isFixed<T> ? 8*fixedBytes<T> + fixedBits<T> : variable;
+
+	// Least bits a T takes, which bounds how many of them the rest of a range can hold.
+	template<typename T, typename = void> constexpr size_t minBits = isFixed<T> ? fixedBitLength<T> : 0;
+	template<typename T> constexpr size_t minBits<T, std::void_t<decltype(Type<T>::minBits)>> = Type<T>::minBits;
+
+	// Structs return their members as a tuple from operator~, a conversion to an integer doesn't count.
+	template<typename T> constexpr bool isTuple = false;
+	template<typename... A> constexpr bool isTuple<std::tuple<A...>> = true;
+	template<typename T, typename = void> constexpr bool isStruct = false;
+	template<typename T> constexpr bool isStruct<T, std::void_t<decltype(~std::declval<const T&>())>> = std::is_class_v<T> && isTuple<decltype(~std::declval<const T&>())>;
+
+	// Types whose unpacked values point into the bytes they were unpacked from.
+	template<typename T, typename = void> constexpr bool isBorrowed = false;
+	template<> constexpr bool isBorrowed<std::string_view> = true;
+	template<typename T> constexpr bool isBorrowed<std::optional<T>> = isBorrowed<T>;
+	template<typename T, typename A> constexpr bool isBorrowed<std::vector<T, A>> = isBorrowed<T>;
+	template<typename... A> constexpr bool isBorrowed<std::tuple<A...>> = (isBorrowed<std::decay_t<A>> || ...);
+	template<typename T> constexpr bool isBorrowed<T, std::enable_if_t<isStruct<T>>> = isBorrowed<decltype(~std::declval<const T&>())>;
+
+	// Types whose least bits depend on the message being unpacked, see Type<Interned<S>>.
+	template<typename T, typename R, typename = void> constexpr bool hasLeastBits = false;
+	template<typename T, typename R> constexpr bool hasLeastBits<T, R, std::void_t<decltype(Type<T>::leastBits(std::declval<const R&>()))>> = true;
+
+	// Types that can unpack into an existing value, reusing the memory it holds.
+	template<typename T, typename R, typename = void> constexpr bool hasUnpackInto = false;
+	template<typename T, typename R> constexpr bool hasUnpackInto<T, R, std::void_t<decltype(Type<T>::unpackInto(std::declval<R&>(), std::declval<T&>()))>> = true;
+
+	// Buffer of a streaming reader and the function refilling it. read(dest, len) stores up to
+	// len bytes at dest and returns their number, which is 0 only at the end of the stream.
+	// offset is the position of the buffer in the stream.
+	struct Source
+	{
+		std::function<size_t(char*, size_t)> read;
+		std::vector<char> buffer;
+		size_t offset = 0;
+	};
+
+	// Worker threads unpacking the elements of indexed lists of at least threshold elements in
+	// chunks, the thread calling run() takes part too. See BasicReader::pool().
+	class ThreadPool
+	{
+	public:
+		explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency(), size_t threshold = 1024) : threshold(threshold)
+		{
+			for(unsigned i = 1; i < threads; ++i) workers.emplace_back([this] { work(); });
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard lock(mutex);
+				stop = true;
+			}
+			wake.notify_all();
+			for(auto& t : workers) t.join();
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		size_t size() const noexcept { return workers.size() + 1; }
+
+		// Calls f(i) for each i < n and returns when all calls are done, rethrowing the first exception.
+		// Once a call has thrown the ones not started yet are dropped.
+		template<typename F> void run(size_t n, F&& f)
+		{
+			std::lock_guard serial(running);
+			std::unique_lock lock(mutex);
+			task = f;
+			next = 0;
+			count = pending = n;
+			error = nullptr;
+			wake.notify_all();
+			take(lock);
+			done.wait(lock, [&] { return !pending; });
+			task = nullptr;
+			if(error) std::rethrow_exception(error);
+		}
+
+		const size_t threshold;
+
+	private:
+		void work()
+		{
+			std::unique_lock lock(mutex);
+			for(;;)
+			{
+				wake.wait(lock, [&] { return stop || next < count; });
+				if(stop) return;
+				take(lock);
+			}
+		}
+
+		void take(std::unique_lock<std::mutex>& lock)
+		{
+			while(next < count)
+			{
+				size_t i = next++;
+				lock.unlock();
+				std::exception_ptr e;
+				try { task(i); } catch(...) { e = std::current_exception(); }
+				lock.lock();
+				if(e && !error)
+				{
+					error = e;
+					pending -= count - next;
+					next = count;
+				}
+				if(!--pending) done.notify_all();
+			}
+		}
+
+		std::vector<std::thread> workers;
+		std::mutex running, mutex;
+		std::condition_variable wake, done;
+		std::function<void(size_t)> task;
+		size_t next = 0, count = 0, pending = 0;
+		std::exception_ptr error;
+		bool stop = false;
+	};
+
+	enum class Error : uint8_t { none, truncated, trailing, invalid, budget };
+
+	// Strings of a message packed as WithStrings<T>, every Interned string in it is packed as an index
+	// of bits bits into them.
+	struct StringTable
+	{
+		void add(std::string_view s)
+		{
+			if(index.emplace(s, uint32_t(strings.size())).second) strings.push_back(s);
+		}
+
+		std::vector<std::string_view> strings;
+		std::unordered_map<std::string_view, uint32_t> index;
+		uint8_t bits = 0;
+	};
+
+	// Value unpacked by tryUnpack(), or the error and its offset from where unpacking started.
+	template<typename T> struct Result
+	{
+		Result(T value) : value(std::move(value)) {}
+		Result(Error error, size_t offset) noexcept : error(error), offset(offset) {}
+
+		explicit operator bool() const noexcept { return error == Error::none; }
+		T& operator*() { return *value; }
+		T* operator->() { return &*value; }
+
+		std::optional<T> value;
+		Error error = Error::none;
+		size_t offset = 0;
+	};
+
+	// Checked readers throw std::range_error when the range runs out, unchecked ones are only
+	// created after checking the whole length of the values up front (see fitting<T>()).
+	// Checked readers that don't throw are used by tryUnpack(), see fail().
+	template<bool Checked, bool Throwing = Checked> struct BasicReader
+	{
+		BasicReader(const char* from, const char* to) noexcept : from(from), to(to) {}
+		BasicReader(std::string_view src) noexcept : from(src.data()), to(src.data() + src.size()) {}
+		BasicReader(const std::vector<char>& src) noexcept : from(src.data()), to(src.data() + src.size()) {}
+		explicit BasicReader(Source& src) noexcept : from(src.buffer.data()), to(from), source(&src) {}
+		template<bool C, bool T> explicit BasicReader(const BasicReader<C, T>& r) noexcept : from(r.from), to(r.to), source(r.source), memory(r.memory), workers(r.workers), table(r.table), allowance(r.allowance), shared(r.shared), limited(r.limited), bits(r.bits), bitsLeft(r.bitsLeft), error(r.error), failedAt(r.failedAt) {}
+
+		size_t size() const noexcept { return to - from; }
+		const char* data() const noexcept { return from; }
+		bool streaming() const noexcept { return source; }
+
+		// Memory resource of the pmr containers unpacked by this reader, the default one unless set.
+		std::pmr::memory_resource* resource() const noexcept { return memory ? memory : std::pmr::get_default_resource(); }
+		void resource(std::pmr::memory_resource* r) noexcept { memory = r; }
+
+		// Pool unpacking large indexed lists in parallel, none unless set. The memory resource must
+		// then be thread safe, like the default one or std::pmr::synchronized_pool_resource.
+		// Streaming readers don't use it.
+		ThreadPool* pool() const noexcept { return streaming() ? nullptr : workers; }
+		void pool(ThreadPool* p) noexcept { workers = p; }
+
+		// String table of the message being unpacked, see WithStrings.
+		const StringTable* strings() const noexcept { return table; }
+		void strings(const StringTable* t) noexcept { table = t; }
+
+		// Bytes the lists and strings unpacked from now on may allocate in total, unlimited unless set.
+		// A shared budget is charged by every reader given it, like the ones on the threads of a pool.
+		bool budgeted() const noexcept { return limited; }
+		size_t budget() const noexcept { return shared ? shared->load() : allowance; }
+		std::atomic<size_t>* sharedBudget() const noexcept { return shared; }
+		void budget(size_t bytes) noexcept
+		{
+			allowance = bytes;
+			shared = nullptr;
+			limited = true;
+		}
+		void budget(std::atomic<size_t>& bytes) noexcept
+		{
+			shared = &bytes;
+			limited = true;
+		}
+
+		// Bytes that a list of Ts which may take no bits can allocate without a budget, as nothing
+		// else bounds how many of them a message holds.
+		static constexpr size_t unbudgeted = 1 << 24;
+
+		// Accounts for a list of count Ts about to be allocated and returns how many of them may be
+		// reserved up front. Fails if the rest of the range can't hold that many, by the least bits
+		// a T takes, or if they exceed the budget. Without a budget, a count the range doesn't bound
+		// (the rest of a stream is unknown) is trusted for none of them, and Ts that may take no bits
+		// are limited to unbudgeted bytes.
+		template<typename T> size_t allocate(size_t count)
+		{
+			if constexpr(Checked)
+			{
+				size_t least = minBits<T>;
+				if constexpr(hasLeastBits<T, BasicReader>) least = Type<T>::leastBits(*this);
+				bool bounded = !source && least;
+				if(bounded && count > (8*size() + bitsLeft)/least) return fail(Error::truncated, "Insufficient bytes in range");
+				if(!limited && !least && count > unbudgeted/sizeof(T)) return fail(Error::budget, "Too many elements taking no bits without a budget");
+				if(!limited) return bounded ? count : 0;
+				if(!shared)
+				{
+					if(count > allowance/sizeof(T)) return fail(Error::budget, "Allocation budget exceeded");
+					allowance -= count*sizeof(T);
+				}
+				else for(size_t left = shared->load(std::memory_order_relaxed);;)
+				{
+					if(count > left/sizeof(T)) return fail(Error::budget, "Allocation budget exceeded");
+					if(shared->compare_exchange_weak(left, left - count*sizeof(T), std::memory_order_relaxed)) break;
+				}
+			}
+			return count;
+		}
+
+		// Makes len bytes available in the range, refilling the buffer of a streaming reader.
+		bool require(size_t len)
+		{
+			if(len <= size()) return true;
+			if(!source || len > source->buffer.size()) return fail(Error::truncated, "Insufficient bytes in range");
+			char* begin = source->buffer.data();
+			size_t left = size();
+			source->offset += from - begin;
+			memmove(begin, from, left);
+			from = begin;
+			to = begin + left;
+			while(size() < len)
+			{
+				size_t n = source->read(begin + size(), source->buffer.size() - size());
+				if(!n) return fail(Error::truncated, "Insufficient bytes in stream");
+				to += n;
+			}
+			return true;
+		}
+
+		// Whether a reader that doesn't throw has run out of bytes, values read since are zero or empty.
+		bool failed() const noexcept
+		{
+			if constexpr(Checked && !Throwing) return error != Error::none;
+			else return false;
+		}
+
+		void read(void* dest, size_t len)
+		{
+			if constexpr(Checked) if(len > size() && !require(len)) return (void)memset(dest, 0, len);
+			memcpy(dest, from, len);
+			from += len;
+		}
+
+		// Borrows len bytes from the range, the result stays valid as long as the source does.
+		// For a streaming reader that is until the next refill, and len is limited by its buffer.
+		std::string_view view(size_t len)
+		{
+			if constexpr(Checked) if(len > size() && !require(len)) return std::string_view();
+			std::string_view v(from, len);
+			from += len;
+			return v;
+		}
+
+		// Passes the next len bytes to f, in pieces no larger than the buffer of a streaming reader.
+		template<typename F> void readChunks(size_t len, F&& f)
+		{
+			if constexpr(Checked) if(len > size() && source)
+			{
+				for(size_t n; len; len -= n)
+				{
+					n = std::min(len, source->buffer.size());
+					if(!require(n)) return;
+					f(view(n));
+				}
+				return;
+			}
+			f(view(len));
+		}
+
+		void skipBytes(size_t len) { readChunks(len, [](std::string_view) {}); }
+
+		// Bit groups: the bits left over from the last fetched bit byte are kept in an accumulator,
+		// a read that needs more pulls all of the following bit bytes with a single word load.
+		uint32_t readBits(uint8_t count)
+		{
+			if(count <= bitsLeft)
+			{
+				uint32_t result = bits & ((uint64_t(1) << count) - 1);
+				bits >>= count;
+				bitsLeft -= count;
+				return result;
+			}
+			size_t n = (count - bitsLeft + 7)/8;
+			uint64_t word = 0;
+			if(size() >= sizeof(word))
+			{
+				memcpy(&word, from, sizeof(word));
+				word &= (uint64_t(1) << 8*n) - 1;
+				from += n;
+			}
+			else read(&word, n);
+			bits |= word << bitsLeft;
+			uint32_t result = bits & ((uint64_t(1) << count) - 1);
+			bits >>= count;
+			bitsLeft += 8*n - count;
+			return result;
+		}
+
+		// Reads count values of width bits each as one run of the bit groups, passing each to f.
+		// The run is consumed through a local accumulator refilled up to 7 bytes at a time.
+		template<typename F> void readBitsRun(size_t count, uint8_t width, F&& f)
+		{
+			size_t total = count*width;
+			size_t n = total > bitsLeft ? (total - bitsLeft + 7)/8 : 0;
+			if constexpr(Checked) if(!require(n)) return;
+			const char* p = from;
+			const char* end = from + n;
+			uint64_t acc = bits;
+			uint8_t accBits = bitsLeft;
+			uint64_t mask = (uint64_t(1) << width) - 1;
+			while(count--)
+			{
+				if(accBits < width)
+				{
+					size_t k = std::min<size_t>((63 - accBits)/8, end - p);
+					uint64_t word = 0;
+					if(to - p >= 8) memcpy(&word, p, sizeof(word));
+					else memcpy(&word, p, k);
+					acc |= (word & ((uint64_t(1) << 8*k) - 1)) << accBits;
+					p += k;
+					accBits += 8*k;
+				}
+				f(acc & mask);
+				acc >>= width;
+				accBits -= width;
+			}
+			from = p;
+			bits = acc;
+			bitsLeft = accBits;
+		}
+
+		// Skips count bits of the bit groups, the bytes they take are found without reading them.
+		void skipBits(size_t count)
+		{
+			if(count <= bitsLeft)
+			{
+				bits >>= count;
+				bitsLeft -= count;
+				return;
+			}
+			count -= bitsLeft;
+			size_t n = (count + 7)/8;
+			skipBytes(n - 1);
+			uint8_t last;
+			read(&last, 1);
+			uint8_t used = count - 8*(n - 1);
+			bits = last >> used;
+			bitsLeft = 8 - used;
+		}
+
+		// How many of the next count values of fixed-length T can be read unchecked right away.
+		// Other readers need all of them to be in the range, a streaming reader refills its buffer
+		// for as many as fit in it. Fails if none of them are available.
+		template<typename T> size_t fitting(size_t count)
+		{
+			if constexpr(Checked && fixedBitLength<T> != 0)
+			{
+				// k values take k*fixedBytes bytes plus the bytes for k*fixedBits bits not fitting in
+				// the current bit byte, which is at most size() iff k*fixedBitLength <= 8*size() + bitsLeft
+				size_t k = (8*size() + bitsLeft)/fixedBitLength<T>;
+				if(k >= count) return count;
+				if(source)
+				{
+					size_t capacity = source->buffer.size();
+					if(!require(count > 8*capacity/fixedBitLength<T> ? capacity : (count*fixedBitLength<T> - bitsLeft + 7)/8)) return 0;
+					if((k = (8*size() + bitsLeft)/fixedBitLength<T>)) return std::min(k, count);
+				}
+				return fail(Error::truncated, "Insufficient bytes in range");
+			}
+			return count;
+		}
+
+		template<typename T> auto unpack()
+		{
+			using U = std::decay_t<T>;
+			if constexpr(Checked && isFixed<U>)
+			{
+				if(!fitting<U>(1)) return decltype(Type<U>::unpack(std::declval<BasicReader<false>&>()))();
+				BasicReader<false> r(*this);
+				auto x = Type<U>::unpack(r);
+				*this = BasicReader(r);
+				return x;
+			}
+			else return Type<U>::unpack(*this);
+		}
+
+		// Reads a nested message with f, its bit groups start afresh and the current one continues after it.
+		// It has no string table, its interned strings are whole.
+		template<typename F> void nested(F&& f)
+		{
+			uint64_t b = std::exchange(bits, 0);
+			uint8_t left = std::exchange(bitsLeft, 0);
+			const StringTable* t = std::exchange(table, nullptr);
+			f();
+			bits = b;
+			bitsLeft = left;
+			table = t;
+		}
+
+		// Moves past a T without constructing it.
+		template<typename T> void skip()
+		{
+			using U = std::decay_t<T>;
+			if constexpr(Checked && isFixed<U>)
+			{
+				if(!fitting<U>(1)) return;
+				BasicReader<false> r(*this);
+				Type<U>::skip(r);
+				*this = BasicReader(r);
+			}
+			else Type<U>::skip(*this);
+		}
+
+		// Overwrites x, its strings and lists keep their capacity and only grow if they need to.
+		template<typename T> void unpackInto(T& x)
+		{
+			if constexpr(isFixed<T> || !hasUnpackInto<T, BasicReader>) x = unpack<T>();
+			else Type<T>::unpackInto(*this, x);
+		}
+
+		// Unpacks T without throwing when the bytes run out, the error is returned instead.
+		// The reader is then left at the end of its range.
+		template<typename T> auto tryUnpack() -> Result<decltype(unpack<T>())>
+		{
+			BasicReader<true, false> r(*this);
+			r.error = Error::none;
+			size_t start = position();
+			auto x = r.template unpack<T>();
+			*this = BasicReader(r);
+			if(r.failed()) return {r.error, r.failedAt - start};
+			return x;
+		}
+
+		Error status() const noexcept { return error; }
+
+		// Running out of bytes or invalid bytes throw, unless the reader doesn't: the first error and its
+		// position are kept and the range is emptied, so that the rest of the value is read as zeros.
+		bool fail([[maybe_unused]] Error e, [[maybe_unused]] const char* message)
+		{
+			if constexpr(Throwing) throw std::range_error(message);
+			else
+			{
+				if(error == Error::none)
+				{
+					error = e;
+					failedAt = position();
+				}
+				from = to;
+				bits = 0;
+				bitsLeft = 0;
+				return false;
+			}
+		}
+
+	private:
+		template<bool, bool> friend struct BasicReader;
+
+		// Position in the stream of a streaming reader, otherwise the address of the next byte.
+		size_t position() const noexcept { return source ? source->offset + (from - source->buffer.data()) : reinterpret_cast<size_t>(from); }
+
+		const char* from;
+		const char* to;
+		Source* source = nullptr;
+		std::pmr::memory_resource* memory = nullptr;
+		ThreadPool* workers = nullptr;
+		const StringTable* table = nullptr;
+		size_t allowance = std::numeric_limits<size_t>::max();
+		std::atomic<size_t>* shared = nullptr;
+		bool limited = false;
+		uint64_t bits = 0;
+		uint8_t bitsLeft = 0;
+		Error error = Error::none;
+		size_t failedAt = 0;
+	};
+
+	using Reader = BasicReader<true>;
+	using UncheckedReader = BasicReader<false>;
+
+	// Reader over a stream of any length, keeping at most capacity bytes of it buffered.
+	struct StreamReader : private Source, public Reader
+	{
+		StreamReader(std::function<size_t(char*, size_t)> read, size_t capacity = 1 << 16) :
+			Source{std::move(read), std::vector<char>(capacity)}, Reader(static_cast<Source&>(*this)) {}
+
+		StreamReader(std::istream& in, size_t capacity = 1 << 16) : StreamReader([&in](char* dest, size_t len) -> size_t
+		{
+			// block for one byte only, then take what is already buffered
+			if(!in.read(dest, 1)) return 0;
+			return 1 + std::max<std::streamsize>(in.readsome(dest + 1, len - 1), 0);
+		}, capacity) {}
+
+#if __has_include(<unistd.h>)
+		StreamReader(int fd, size_t capacity = 1 << 16) : StreamReader([fd](char* dest, size_t len) -> size_t
+		{
+			ssize_t n;
+			while((n = ::read(fd, dest, len)) < 0) if(errno != EINTR) throw std::system_error(errno, std::generic_category());
+			return n;
+		}, capacity) {}
+#endif
+
+		StreamReader(const StreamReader&) = delete;
+		StreamReader& operator=(const StreamReader&) = delete;
+	};
+
+	// Bit writing shared by all writers, W provides grow(len) reserving len bytes at the end
+	// and at(pos) addressing an already written byte.
+	template<typename W> struct BitWriter
+	{
+		// The first bit of a group reserves a byte at the current end, later bits fill it up
+		// and spill over into new bytes which are appended together as one little-endian word.
+		void writeBits(uint32_t bits, uint8_t count)
+		{
+			if(!count) return;
+			uint64_t v = bits & ((uint64_t(1) << count) - 1);
+			if(bitsLeft)
+			{
+				self().at(bitsPos) |= v << (8 - bitsLeft);
+				if(count <= bitsLeft)
+				{
+					bitsLeft -= count;
+					return;
+				}
+				v >>= bitsLeft;
+				count -= bitsLeft;
+			}
+			size_t n = (count + 7)/8;
+			memcpy(self().grow(n), &v, n);
+			bitsPos = self().size() - 1;
+			bitsLeft = 8*n - count;
+		}
+
+		// Writes count values of width bits each, taken from f(i), as one run of the bit groups.
+		// The pending bit byte is completed first, the rest goes to bytes grown in one step.
+		template<typename F> void writeBitsRun(size_t count, uint8_t width, F&& f)
+		{
+			size_t total = count*width;
+			size_t n = total > bitsLeft ? (total - bitsLeft + 7)/8 : 0;
+			char* out = self().grow(n);
+			uint64_t mask = (uint64_t(1) << width) - 1;
+			uint64_t acc = 0;
+			uint8_t accBits = 0;
+			size_t i = 0;
+			if(bitsLeft)
+			{
+				char& pending = self().at(bitsPos);
+				acc = uint8_t(pending);
+				accBits = 8 - bitsLeft;
+				while(accBits < 8 && i < count)
+				{
+					acc |= (f(i++) & mask) << accBits;
+					accBits += width;
+				}
+				pending = char(acc);
+				if(accBits < 8)
+				{
+					bitsLeft = 8 - accBits;
+					return;
+				}
+				acc >>= 8;
+				accBits -= 8;
+			}
+			for(; i < count; ++i)
+			{
+				acc |= (f(i) & mask) << accBits;
+				accBits += width;
+				if(accBits >= 32)
+				{
+					memcpy(out, &acc, 4);
+					out += 4;
+					acc >>= 32;
+					accBits -= 32;
+				}
+			}
+			size_t k = (accBits + 7)/8;
+			memcpy(out, &acc, k);
+			bitsPos = self().size() - 1;
+			bitsLeft = 8*k - accBits;
+		}
+
+		// Grows len bytes in one step for f(char*) to fill in, they can't hold bits of a bit group.
+		template<typename F> void writeBytes(size_t len, F&& f) { f(self().grow(len)); }
+
+		template<typename T> void pack(const T& x) { Type<std::decay_t<T>>::packInto(self(), x); }
+
+		// Ends the bit group, values packed after it start a new message.
+		void finish() noexcept { bitsLeft = 0; }
+
+		// Pool packing large indexed lists in parallel, none unless set.
+		ThreadPool* pool() const noexcept { return workers; }
+		void pool(ThreadPool* p) noexcept { workers = p; }
+
+		// String table of the message being packed, see WithStrings.
+		const StringTable* strings() const noexcept { return table; }
+		void strings(const StringTable* t) noexcept { table = t; }
+
+		// Writes a nested message with f, its bit groups start afresh and the current one continues after it.
+		// It has no string table, its interned strings are whole.
+		template<typename F> void nested(F&& f)
+		{
+			size_t pos = bitsPos;
+			uint8_t left = std::exchange(bitsLeft, 0);
+			const StringTable* t = std::exchange(table, nullptr);
+			f();
+			bitsPos = pos;
+			bitsLeft = left;
+			table = t;
+		}
+
+	protected:
+		size_t bitsPos = 0;
+		uint8_t bitsLeft = 0;
+		ThreadPool* workers = nullptr;
+		const StringTable* table = nullptr;
+
+	private:
+		W& self() { return static_cast<W&>(*this); }
+	};
+
+	// Appends to a vector, which holds exactly the bytes written so far.
+	struct Writer : BitWriter<Writer>
+	{
+		Writer(std::vector<char>& dest) noexcept : dest(dest) {}
+
+		size_t size() const noexcept { return dest.size(); }
+		void write(const void* src, size_t len) { memcpy(grow(len), src, len); }
+
+	private:
+		friend BitWriter<Writer>;
+
+		char& at(size_t pos) { return dest[pos]; }
+
+		char* grow(size_t len)
+		{
+			size_t pos = dest.size();
+			if(dest.capacity() - pos < len) dest.reserve(std::max(2*dest.capacity(), pos + len));
+			dest.resize(pos + len);
+			return dest.data() + pos;
+		}
+
+		std::vector<char>& dest;
+	};
+
+	// Appends to a vector in a single pass of raw pointer writes, growing it in doubling steps
+	// ahead of the bytes written. It's trimmed to them when the writer is destroyed, until then
+	// it ends in padding.
+	struct GrowingWriter : BitWriter<GrowingWriter>
+	{
+		GrowingWriter(std::vector<char>& dest) noexcept : dest(dest), begin(dest.data()), cur(begin + dest.size()), end(cur) {}
+		~GrowingWriter() { dest.resize(size()); }
+
+		GrowingWriter(const GrowingWriter&) = delete;
+		GrowingWriter& operator=(const GrowingWriter&) = delete;
+
+		size_t size() const noexcept { return cur - begin; }
+		void write(const void* src, size_t len) { memcpy(grow(len), src, len); }
+
+	private:
+		friend BitWriter<GrowingWriter>;
+
+		char& at(size_t pos) { return begin[pos]; }
+
+		char* grow(size_t len)
+		{
+			if(size_t(end - cur) < len) expand(len);
+			char* p = cur;
+			cur += len;
+			return p;
+		}
+
+		void expand(size_t len)
+		{
+			size_t used = size();
+			dest.resize(std::max(2*dest.size(), used + std::max<size_t>(len, 256)));
+			begin = dest.data();
+			cur = begin + used;
+			end = begin + dest.size();
+		}
+
+		std::vector<char>& dest;
+		char* begin;
+		char* cur;
+		char* end;
+	};
+
+	// Writes into a caller-owned buffer. Capacity is checked once by the caller (see bw::pack
+	// below), the writes themselves are unchecked.
+	struct BufferWriter : BitWriter<BufferWriter>
+	{
+		BufferWriter(char* from, char* to) noexcept : begin(from), cur(from), end(to) {}
+		BufferWriter(char* dest, size_t capacity) noexcept : BufferWriter(dest, dest + capacity) {}
+
+		size_t size() const noexcept { return cur - begin; }
+		size_t capacity() const noexcept { return end - begin; }
+		void write(const void* src, size_t len) { memcpy(grow(len), src, len); }
+
+	private:
+		friend BitWriter<BufferWriter>;
+
+		char& at(size_t pos) { return begin[pos]; }
+
+		char* grow(size_t len)
+		{
+			assert(len <= size_t(end - cur));
+			char* p = cur;
+			cur += len;
+			return p;
+		}
+
+		char* begin;
+		char* cur;
+		char* end;
+	};
+
+	// Destination of a streaming writer. write(src, len) appends to the stream, patch(pos, byte)
+	// overwrites the byte at offset pos from where the writer started, it is empty if that can't be done.
+	struct Sink
+	{
+		std::function<void(const char*, size_t)> write;
+		std::function<void(size_t, char)> patch;
+	};
+
+	// Writes to a stream while buffering at most capacity bytes, flush() must follow the last value.
+	// An open bit byte still changes after later bytes are written: it is patched in place if the
+	// sink can do that, otherwise the bytes from it on are held back, growing the buffer if needed.
+	struct StreamWriter : BitWriter<StreamWriter>
+	{
+		StreamWriter(Sink sink, size_t capacity = 1 << 16) : sink(std::move(sink)), buffer(capacity) {}
+
+		StreamWriter(std::ostream& out, size_t capacity = 1 << 16) : StreamWriter(Sink{
+			[&out](const char* src, size_t len) { if(!out.write(src, len)) throw std::ios_base::failure("Failed to write stream"); },
+			out.tellp() == -1 ? nullptr : std::function<void(size_t, char)>([&out, start = out.tellp()](size_t pos, char byte)
+			{
+				auto end = out.tellp();
+				if(!out.seekp(start + std::streamoff(pos)).put(byte).seekp(end)) throw std::ios_base::failure("Failed to write stream");
+			})}, capacity) {}
+
+#if __has_include(<unistd.h>)
+		StreamWriter(int fd, size_t capacity = 1 << 16) : StreamWriter(Sink{
+			[fd](const char* src, size_t len)
+			{
+				for(ssize_t n; len; src += n, len -= n)
+					while((n = ::write(fd, src, len)) < 0) if(errno != EINTR) throw std::system_error(errno, std::generic_category());
+			},
+			lseek(fd, 0, SEEK_CUR) == -1 ? nullptr : std::function<void(size_t, char)>([fd, start = lseek(fd, 0, SEEK_CUR)](size_t pos, char byte)
+			{
+				while(pwrite(fd, &byte, 1, start + pos) < 0) if(errno != EINTR) throw std::system_error(errno, std::generic_category());
+			})}, capacity) {}
+#endif
+
+		size_t size() const noexcept { return base + used; }
+
+		void write(const void* src, size_t len)
+		{
+			if(len < buffer.size()) return (void)memcpy(grow(len), src, len);
+			drain();
+			if(used) return (void)memcpy(grow(len), src, len);
+			sink.write(static_cast<const char*>(src), len);
+			base += len;
+		}
+
+		// The open bit byte of the enclosing message has to outlive a nested one: it takes patchByte for
+		// the time being, or if that is taken by an outer message, the bytes from it on are held back.
+		template<typename F> void nested(F&& f)
+		{
+			size_t wasHeld = held;
+			bool wasPinned = pinned;
+			if(bitsLeft)
+			{
+				if(sink.patch && !pinned)
+				{
+					if(patchPos != bitsPos)
+					{
+						if(patchPos != closed) release();
+						patchByte = buffer[bitsPos - base];
+						patchPos = bitsPos;
+					}
+					pinned = true;
+				}
+				else held = std::min(held, bitsPos);
+			}
+			BitWriter::nested(f);
+			held = wasHeld;
+			pinned = wasPinned;
+		}
+
+		// Passes everything on and closes the bit group, values packed after it start a new message.
+		void flush()
+		{
+			finish();
+			drain();
+		}
+
+	private:
+		friend BitWriter<StreamWriter>;
+
+		char& at(size_t pos) { return pos == patchPos ? patchByte : buffer[pos - base]; }
+
+		char* grow(size_t len)
+		{
+			if(used + len > buffer.size())
+			{
+				drain();
+				if(used + len > buffer.size()) buffer.resize(used + len);
+			}
+			char* p = buffer.data() + used;
+			used += len;
+			return p;
+		}
+
+		// Passes the buffered bytes on, except from an open bit byte on if it can't be patched later.
+		// An open bit byte that was passed on lives in patchByte until it's closed.
+		void drain()
+		{
+			if(patchPos != closed && !pinned && (!bitsLeft || bitsPos != patchPos)) release();
+			bool open = bitsLeft && bitsPos >= base && bitsPos != patchPos;
+			size_t len = std::min(used, held - base);
+			if(open && (!sink.patch || patchPos != closed)) len = std::min(len, bitsPos - base);
+			if(len) sink.write(buffer.data(), len);
+			if(open && sink.patch && patchPos == closed)
+			{
+				patchPos = bitsPos;
+				patchByte = buffer[bitsPos - base];
+			}
+			memmove(buffer.data(), buffer.data() + len, used - len);
+			used -= len;
+			base += len;
+		}
+
+		void release()
+		{
+			if(patchPos >= base) buffer[patchPos - base] = patchByte;
+			else sink.patch(patchPos, patchByte);
+			patchPos = closed;
+		}
+
+		static constexpr size_t closed = std::numeric_limits<size_t>::max();
+
+		size_t held = closed;
+		bool pinned = false;
+
+		Sink sink;
+		std::vector<char> buffer;
+		size_t used = 0;
+		size_t base = 0;
+		size_t patchPos = closed;
+		char patchByte = 0;
+	};
+
+	// Bits of a single value made of bit fields only, used to split list elements into their fields.
+	struct WordReader
+	{
+		uint64_t bits;
+
+		uint32_t readBits(uint8_t count)
+		{
+			uint32_t result = bits & ((uint64_t(1) << count) - 1);
+			bits >>= count;
+			return result;
+		}
+
+		template<typename T> auto unpack() { return Type<std::decay_t<T>>::unpack(*this); }
+	};
+
+	struct WordWriter
+	{
+		uint64_t bits = 0;
+		uint8_t count = 0;
+
+		void writeBits(uint32_t v, uint8_t n)
+		{
+			bits |= (v & ((uint64_t(1) << n) - 1)) << count;
+			count += n;
+		}
+
+		template<typename T> void pack(const T& x) { Type<std::decay_t<T>>::packInto(*this, x); }
+	};
+
+	constexpr uint8_t bitsNeeded(size_t max) { return 32 - __builtin_clz(max); }
+	template<typename T> std::string toString(const T& x) { return Type<std::decay_t<T>>::toString(x); }
+	template<typename T> constexpr size_t bitLength(const T& x)
+	{
+		if constexpr(isFixed<T>) return fixedBitLength<T>;
+		else return Type<std::decay_t<T>>::bitLength(x);
+	}
+	template<typename T> constexpr size_t byteLength(const T& x) { return (bitLength(x) + 7)/8; }
+	template<typename T> T unpack(const std::vector<char>& buf) { return Reader(buf).unpack<T>(); }
+	template<typename T> void unpackInto(const std::vector<char>& buf, T& x) { Reader(buf).unpackInto(x); }
+	template<typename T> void skip(Reader& r) { r.skip<T>(); }
+
+	// Checks that the range holds exactly one well-formed T, without unpacking it.
+	template<typename T> Error validate(BasicReader<true, false> r)
+	{
+		r.skip<T>();
+		return r.failed() ? r.status() : r.size() ? Error::trailing : Error::none;
+	}
+
+	// Allocator of an unpacked container, pmr containers allocate from the resource of the reader.
+	template<typename A, typename R> A allocator(const R& r)
+	{
+		if constexpr(std::is_same_v<A, std::pmr::polymorphic_allocator<typename A::value_type>>) return A(r.resource());
+		else return A();
+	}
+
+	template<typename T> size_t pack(const T& x, char* dest, size_t capacity)
+	{
+		size_t len = byteLength(x);
+		if(len > capacity) throw std::range_error("Insufficient buffer capacity");
+		BufferWriter(dest, len).pack(x);
+		return len;
+	}
+
+	// Selects packing in a single pass into a growing buffer, instead of walking x once for its
+	// exact length first. That pays off for values with many variable-length members.
+	inline constexpr struct SinglePass {} singlePass;
+
+	template<typename T> std::vector<char> pack(const T& x)
+	{
+		std::vector<char> r(byteLength(x));
+		BufferWriter(r.data(), r.size()).pack(x);
+		return r;
+	}
+
+	// Packs the large indexed lists in x on the threads of pool, see Type<IndexedList<T>>.
+	template<typename T> std::vector<char> pack(const T& x, ThreadPool& pool)
+	{
+		std::vector<char> r(byteLength(x));
+		BufferWriter w(r.data(), r.size());
+		w.pool(&pool);
+		w.pack(x);
+		return r;
+	}
+
+	template<typename T> std::vector<char> pack(const T& x, SinglePass)
+	{
+		std::vector<char> r;
+		GrowingWriter(r).pack(x);
+		return r;
+	}
+
+	// Compression of packed bytes into frames of frameMagic, the method (0 stored, 1 LZ block), the
+	// unpacked length and the length of the following data as uint32 values. Frames unpack to at most
+	// frameLimit bytes, longer data is split into several, and data shorter than the threshold or that
+	// doesn't get shorter is stored as it is.
+	inline constexpr char frameMagic[3] = {'b', 'w', 'z'};
+	constexpr size_t frameHeader = 12;
+	constexpr size_t frameLimit = 1 << 22;
+
+	struct Compression { size_t threshold = 256; };
+	inline constexpr Compression compressed;
+
+	// LZ4-like blocks: sequences of a token holding the number of literals in its high and the match
+	// length minus minMatch in its low nibble, more bytes of either that is 15 until one is below 255,
+	// the literals, then the 16-bit distance back to the match. The last sequence has literals only.
+	namespace lz
+	{
+		constexpr size_t minMatch = 4;
+		constexpr int hashBits = 14;
+
+		inline uint32_t load32(const char* p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+		inline uint64_t load64(const char* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+
+		inline void putLength(std::vector<char>& out, size_t len)
+		{
+			for(; len >= 255; len -= 255) out.push_back(char(255));
+			out.push_back(char(len));
+		}
+
+		inline void sequence(std::vector<char>& out, const char* literals, size_t count, size_t match, size_t distance)
+		{
+			size_t extra = match ? match - minMatch : 0;
+			out.push_back(char(std::min<size_t>(count, 15) << 4 | std::min<size_t>(extra, 15)));
+			if(count >= 15) putLength(out, count - 15);
+			out.insert(out.end(), literals, literals + count);
+			if(!match) return;
+			out.push_back(char(distance));
+			out.push_back(char(distance >> 8));
+			if(extra >= 15) putLength(out, extra - 15);
+		}
+
+		// Appends the block of len bytes at src to out, greedily taking the last earlier occurrence
+		// of the next 4 bytes within reach. The further from the last match, the more bytes are skipped.
+		inline void compress(const char* src, size_t len, std::vector<char>& out)
+		{
+			std::vector<uint32_t> table(1 << hashBits);
+			size_t anchor = 0;
+			for(size_t i = 0; i + minMatch <= len;)
+			{
+				uint32_t v = load32(src + i);
+				uint32_t& slot = table[uint32_t(v*2654435761u) >> (32 - hashBits)];
+				size_t candidate = slot;
+				slot = uint32_t(i);
+				if(candidate >= i || i - candidate > 0xffff || load32(src + candidate) != v)
+				{
+					i += 1 + ((i - anchor) >> 6);
+					continue;
+				}
+				size_t end = i + minMatch;
+				for(size_t c = candidate + minMatch; end < len;)
+				{
+					if(end + 8 <= len)
+					{
+						uint64_t d = load64(src + end) ^ load64(src + c);
+						if(d) { end += __builtin_ctzll(d)/8; break; }
+						end += 8, c += 8;
+					}
+					else if(src[end] == src[c]) ++end, ++c;
+					else break;
+				}
+				sequence(out, src + anchor, i - anchor, end - i, i - candidate);
+				i = anchor = end;
+			}
+			sequence(out, src + anchor, len - anchor, 0, 0);
+		}
+
+		// Unpacks the block of len bytes at src into exactly size bytes at dest.
+		inline void decompress(const char* src, size_t len, char* dest, size_t size)
+		{
+			auto invalid = [] { throw std::range_error("Invalid compressed frame"); };
+			const char* end = src + len;
+			auto length = [&](size_t n)
+			{
+				if(n == 15) for(uint8_t b = 255; b == 255; n += b)
+				{
+					if(src == end) invalid();
+					b = *src++;
+				}
+				return n;
+			};
+			size_t pos = 0;
+			for(;;)
+			{
+				if(src == end) invalid();
+				uint8_t token = *src++;
+				size_t count = length(token >> 4);
+				if(count > size_t(end - src) || count > size - pos) invalid();
+				// short copies of a fixed 16 bytes where both ends have room for them
+				if(count <= 16 && end - src >= 16 && size - pos >= 16) memcpy(dest + pos, src, 16);
+				else memcpy(dest + pos, src, count);
+				src += count;
+				pos += count;
+				if(src == end) break;
+				if(end - src < 2) invalid();
+				size_t distance = uint8_t(src[0]) | uint8_t(src[1]) << 8;
+				src += 2;
+				size_t match = length(token & 15) + minMatch;
+				if(!distance || distance > pos || match > size - pos) invalid();
+				char* to = dest + pos;
+				if(distance >= 16 && match <= 16 && size - pos >= 16) memcpy(to, to - distance, 16);
+				else if(distance >= match) memcpy(to, to - distance, match);
+				else for(size_t i = 0; i < match; ++i) to[i] = to[i - distance];
+				pos += match;
+			}
+			if(pos != size) invalid();
+		}
+	}
+
+	// Appends the frames of len bytes at src to out.
+	inline void compress(const char* src, size_t len, std::vector<char>& out, Compression c = compressed)
+	{
+		for(size_t n; len; src += n, len -= n)
+		{
+			n = std::min(len, frameLimit);
+			size_t start = out.size();
+			out.resize(start + frameHeader);
+			bool lz = n >= c.threshold;
+			if(lz)
+			{
+				lz::compress(src, n, out);
+				lz = out.size() - start - frameHeader < n;
+				if(!lz) out.resize(start + frameHeader);
+			}
+			if(!lz) out.insert(out.end(), src, src + n);
+			uint32_t lengths[2] = {uint32_t(n), uint32_t(out.size() - start - frameHeader)};
+			memcpy(out.data() + start, frameMagic, sizeof(frameMagic));
+			out[start + sizeof(frameMagic)] = lz;
+			memcpy(out.data() + start + 4, lengths, sizeof(lengths));
+		}
+	}
+
+	inline std::vector<char> compress(std::string_view data, Compression c = compressed)
+	{
+		std::vector<char> r;
+		compress(data.data(), data.size(), r, c);
+		return r;
+	}
+
+	// Unpacked and stored length of the frame with the given header.
+	inline std::pair<uint32_t, uint32_t> frameLengths(const char* header)
+	{
+		uint32_t lengths[2];
+		memcpy(lengths, header + 4, sizeof(lengths));
+		if(memcmp(header, frameMagic, sizeof(frameMagic)) || uint8_t(header[3]) > 1 || lengths[0] > frameLimit ||
+				(header[3] ? lengths[1] >= lengths[0] || lengths[0] > 255*uint64_t(lengths[1]) : lengths[1] != lengths[0]))
+			throw std::range_error("Invalid compressed frame");
+		return {lengths[0], lengths[1]};
+	}
+
+	// Unpacks the data of the frame with the given header into its unpacked length at dest.
+	inline void decompressFrame(const char* header, const char* src, char* dest)
+	{
+		auto [size, len] = frameLengths(header);
+		if(header[3]) lz::decompress(src, len, dest, size);
+		else memcpy(dest, src, len);
+	}
+
+	inline std::vector<char> decompress(std::string_view frames)
+	{
+		std::vector<char> r;
+		for(const char* p = frames.data(), *end = p + frames.size(); p != end;)
+		{
+			if(size_t(end - p) < frameHeader) throw std::range_error("Invalid compressed frame");
+			auto [size, len] = frameLengths(p);
+			if(len > size_t(end - p) - frameHeader) throw std::range_error("Invalid compressed frame");
+			r.resize(r.size() + size);
+			decompressFrame(p, p + frameHeader, r.data() + r.size() - size);
+			p += frameHeader + len;
+		}
+		return r;
+	}
+
+	template<typename T> std::vector<char> pack(const T& x, Compression c)
+	{
+		std::vector<char> r;
+		std::vector<char> packed = pack(x);
+		compress(packed.data(), packed.size(), r, c);
+		return r;
+	}
+
+	// Borrowed strings would point into the decompressed copy, unpack those from decompress(buf) instead.
+	template<typename T> T unpack(const std::vector<char>& buf, Compression)
+	{
+		static_assert(!isBorrowed<T>, "Unpack borrowed values from decompress(buf), which has to outlive them");
+		return unpack<T>(decompress({buf.data(), buf.size()}));
+	}
+
+	// Sink for a StreamWriter passing what is written to write as frames. It can't patch, so the
+	// writer holds back open bit bytes.
+	inline Sink compressing(std::function<void(const char*, size_t)> write, Compression c = compressed)
+	{
+		return {[write = std::move(write), c, out = std::vector<char>()](const char* src, size_t len) mutable
+		{
+			out.clear();
+			compress(src, len, out, c);
+			write(out.data(), out.size());
+		}, nullptr};
+	}
+
+	// Read function for a StreamReader taking the frames written through compressing() from read.
+	inline std::function<size_t(char*, size_t)> decompressing(std::function<size_t(char*, size_t)> read)
+	{
+		return [read = std::move(read), frame = std::vector<char>(), data = std::vector<char>(), pos = size_t(0)](char* dest, size_t len) mutable -> size_t
+		{
+			auto fill = [&](char* to, size_t n)
+			{
+				size_t done = 0;
+				for(size_t got; done < n; done += got) if(!(got = read(to + done, n - done))) break;
+				return done;
+			};
+			while(pos == data.size())
+			{
+				char header[frameHeader];
+				size_t got = fill(header, frameHeader);
+				if(!got) return 0;
+				if(got < frameHeader) throw std::range_error("Invalid compressed frame");
+				auto [size, n] = frameLengths(header);
+				frame.resize(n);
+				if(fill(frame.data(), n) < n) throw std::range_error("Invalid compressed frame");
+				data.resize(size);
+				decompressFrame(header, frame.data(), data.data());
+				pos = 0;
+			}
+			size_t n = std::min(len, data.size() - pos);
+			memcpy(dest, data.data() + pos, n);
+			pos += n;
+			return n;
+		};
+	}
+
+	inline float asFloat(uint32_t x) { float f; memcpy(&f, &x, sizeof(x)); return f; }
+	inline float scale(float v, float vmin, float vmax, float min, float max) { return (v - vmin)/(vmax - vmin)*(max - min) + min; }
+
+	template<typename U, uint32_t Min, uint32_t Max> struct Scaled
+	{
+		U value;
+		Scaled() : value() {}
+		Scaled(float v) { *this = v; }
+		explicit Scaled(U value) : value(value) {}
+		static float min() { return asFloat(Min); }
+		static float max() { return asFloat(Max); }
+		operator float() const { return scale(value, std::numeric_limits<U>::min(), std::numeric_limits<U>::max(), min(), max()); }
+		auto& operator=(float v) { value = scale(v, min(), max(), std::numeric_limits<U>::min(), std::numeric_limits<U>::max()); return *this; }
+	};
+
+	// Bytes borrowed from the unpacked buffer, encoded like a string.
+	struct ByteView
+	{
+		ByteView() noexcept {}
+		ByteView(const void* data, size_t size) noexcept : ptr((const uint8_t*)data), len(size) {}
+
+		const uint8_t* data() const noexcept { return ptr; }
+		size_t size() const noexcept { return len; }
+		const uint8_t* begin() const noexcept { return ptr; }
+		const uint8_t* end() const noexcept { return ptr + len; }
+		uint8_t operator[](size_t i) const noexcept { return ptr[i]; }
+		bool operator==(const ByteView& x) const noexcept { return len == x.len && (!len || !memcmp(ptr, x.ptr, len)); }
+		bool operator!=(const ByteView& x) const noexcept { return !(*this == x); }
+
+	private:
+		const uint8_t* ptr = nullptr;
+		size_t len = 0;
+	};
+
+	template<> constexpr bool isBorrowed<ByteView> = true;
+
+	template<typename T> struct Type
+	{
+		static constexpr size_t fixedBytes = Type<decltype(~std::declval<const T&>())>::fixedBytes;
+		static constexpr size_t fixedBits = Type<decltype(~std::declval<const T&>())>::fixedBits;
+		static constexpr size_t minBits = bw::minBits<decltype(~std::declval<const T&>())>;
+		static std::string toString(const T& x) { return bw::toString(~x); }
+		static constexpr size_t bitLength(const T& x) { return bw::bitLength(~x); }
+		template<typename R> static T unpack(R& r) { return Type<decltype(~std::declval<T>())>::template unpackAs<T>(r); }
+		template<typename R> static void unpackInto(R& r, T& x) { Type<decltype(~x)>::unpackInto(r, ~x); }
+		template<typename R> static void skip(R& r) { Type<decltype(~std::declval<T>())>::skip(r); }
+		template<typename W> static void packInto(W& w, const T& x) { w.pack(~x); }
+	};
+
+	template<typename U, uint32_t Min, uint32_t Max> struct Type<Scaled<U, Min, Max>>
+	{
+		using T = Scaled<U, Min, Max>;
+		static constexpr size_t fixedBytes = bw::fixedBytes<U>;
+		static constexpr size_t fixedBits = bw::fixedBits<U>;
+		static std::string toString(const T& x) { return std::to_string((float)x); }
+		static constexpr size_t bitLength(const T& x) { return bw::bitLength(x.value); }
+		template<typename R> static T unpack(R& r) { return T(r.template unpack<U>()); }
+		template<typename R> static void skip(R& r) { Type<U>::skip(r); }
+		template<typename W> static void packInto(W& w, const T& x) { w.template pack<U>(x.value); }
+	};
+
+	// Integer packed in as few bytes as its value needs, see leb128.
+	template<typename T> struct Var
+	{
+		static_assert(std::is_integral_v<T>);
+		T value;
+		Var() : value() {}
+		Var(T value) : value(value) {}
+		operator T() const { return value; }
+	};
+
+	template<typename T> constexpr bool isVar = false;
+	template<typename T> constexpr bool isVar<Var<T>> = true;
+
+	// Integer of N bits, up to 32, kept in T. Use UInt<N> and Int<N>, which keep it in the smallest type.
+	template<uint8_t N, typename T> struct BitInt
+	{
+		static_assert(N >= 1 && N <= 32);
+		T value;
+		BitInt() : value() {}
+		BitInt(T value) : value(value) {}
+		operator T() const { return value; }
+	};
+
+	template<size_t N> using leastUint = std::conditional_t<N <= 8, uint8_t, std::conditional_t<N <= 16, uint16_t, uint32_t>>;
+	template<uint8_t N> using UInt = BitInt<N, leastUint<N>>;
+	template<uint8_t N> using Int = BitInt<N, std::make_signed_t<leastUint<N>>>;
+
+	template<typename T, uint8_t Bits> struct BitsType
+	{
+		static constexpr uint8_t bits = Bits;
+		static constexpr size_t fixedBytes = 0;
+		static constexpr size_t fixedBits = Bits;
+		static std::string toString(const T& x) { return std::to_string(static_cast<uint32_t>(x)); }
+		static constexpr size_t bitLength(const T&) { return bits; }
+		template<typename R> static T unpack(R& r) { return static_cast<T>(r.readBits(bits)); }
+		template<typename R> static void skip(R& r) { r.skipBits(bits); }
+		template<typename W> static void packInto(W& w, const T& x) { w.writeBits(static_cast<uint32_t>(x), bits); }
+	};
+
+	template<typename T, int Count> struct EnumType : BitsType<T, bitsNeeded(Count - 1)>
+	{
+		static constexpr int count = Count;
+	};
+
+	// Packing a value that doesn't fit in N bits throws std::range_error. Not a BitsType, whose
+	// byte-sized fields are gathered without the range check (see byteFieldBits).
+	template<uint8_t N, typename T> struct Type<BitInt<N, T>>
+	{
+		using X = BitInt<N, T>;
+		static constexpr size_t fixedBytes = 0;
+		static constexpr size_t fixedBits = N;
+		static constexpr int64_t min = std::is_signed_v<T> ? -(int64_t(1) << (N - 1)) : 0;
+		static constexpr int64_t max = (int64_t(1) << (std::is_signed_v<T> ? N - 1 : N)) - 1;
+		static std::string toString(const X& x) { return std::to_string(x.value); }
+		static constexpr size_t bitLength(const X&) { return N; }
+
+		template<typename R> static X unpack(R& r)
+		{
+			uint32_t bits = r.readBits(N);
+			if constexpr(std::is_signed_v<T>) return T(int32_t(bits << (32 - N)) >> (32 - N));
+			else return T(bits);
+		}
+
+		template<typename R> static void skip(R& r) { r.skipBits(N); }
+
+		template<typename W> static void packInto(W& w, const X& x)
+		{
+			int64_t v = x.value;
+			if(v < min || v > max) throw std::range_error("Value out of range");
+			w.writeBits(uint32_t(v), N);
+		}
+	};
+
+	template<> struct Type<bool> : BitsType<bool, 1>
+	{
+		static std::string toString(const bool& x) { return x ? "+" : "-"; }
+	};
+
+	template<typename T> struct NumberType
+	{
+		static constexpr size_t fixedBytes = sizeof(T);
+		static constexpr size_t fixedBits = 0;
+		static std::string toString(const T& x) { return std::to_string(x); }
+		static constexpr size_t bitLength(const T&) { return 8*sizeof(T); }
+		template<typename R> static T unpack(R& r) { T x; r.read(&x, sizeof(T)); return x; }
+		template<typename R> static void skip(R& r) { r.skipBytes(sizeof(T)); }
+		template<typename W> static void packInto(W& w, const T& x) { w.write(&x, sizeof(T)); }
+	};
+
+	template<> struct Type<int8_t> : NumberType<int8_t> {};
+	template<> struct Type<int16_t> : NumberType<int16_t> {};
+	template<> struct Type<int32_t> : NumberType<int32_t> {};
+	template<> struct Type<int64_t> : NumberType<int64_t> {};
+	template<> struct Type<uint8_t> : NumberType<uint8_t> {};
+	template<> struct Type<uint16_t> : NumberType<uint16_t> {};
+	template<> struct Type<uint32_t> : NumberType<uint32_t> {};
+	template<> struct Type<uint64_t> : NumberType<uint64_t> {};
+	template<> struct Type<float> : NumberType<float> {};
+
+	namespace varint
+	{
+		static constexpr uint8_t bytesBitsNeeded(size_t v) { return v <= 0xffff ? (v <= 0xff ? 0 : 1) : (v <= 0xffffffff ? 2 : 3); }
+		static constexpr size_t bitLength(size_t x) { return 2 + 8*(size_t(1) << bytesBitsNeeded(x)); }
+		constexpr size_t minBits = bitLength(0);
+
+		template<typename R> static size_t unpack(R& r)
+		{
+			switch(r.readBits(2))
+			{
+				case 0: return r.template unpack<uint8_t>();
+				case 1: return r.template unpack<uint16_t>();
+				case 2: return r.template unpack<uint32_t>();
+			}
+			return r.template unpack<uint64_t>();
+		}
+
+		template<typename R> static void skip(R& r) { r.skipBytes(size_t(1) << r.readBits(2)); }
+
+		template<typename W> static void packInto(W& w, size_t x)
+		{
+			uint8_t bb = bytesBitsNeeded(x);
+			w.writeBits(bb, 2);
+			switch(bb)
+			{
+				case 0: return Type<uint8_t>::packInto(w, x);
+				case 1: return Type<uint16_t>::packInto(w, x);
+				case 2: return Type<uint32_t>::packInto(w, x);
+				case 3: return Type<uint64_t>::packInto(w, x);
+			}
+		}
+	};
+
+	// LEB128: 7 bits per byte from the lowest ones up, the high bit is set on all bytes but the last.
+	// At most 10 bytes are read, bits beyond 64 are dropped.
+	namespace leb128
+	{
+		constexpr size_t byteLength(uint64_t x) { return x ? (63 - __builtin_clzll(x))/7 + 1 : 1; }
+
+		// Decodes the value at p, which must have 10 bytes after it, and returns its end. Values below
+		// 0x80 take the one branch, and the bytes of longer ones are looped over: with the next value's
+		// position known only after this one, a word-at-a-time decode measured slower for all lengths.
+		inline const char* decode(const char* p, uint64_t& v)
+		{
+			v = uint8_t(*p++);
+			if(v < 0x80) return p;
+			v &= 0x7f;
+			for(unsigned shift = 7; shift < 70; shift += 7)
+			{
+				uint8_t b = *p++;
+				v |= uint64_t(b & 0x7f) << shift;
+				if(b < 0x80) break;
+			}
+			return p;
+		}
+
+		// Length of the value at p, which must have 10 bytes after it.
+		inline size_t length(const char* p)
+		{
+			size_t n = 1;
+			while(n < 10 && p[n - 1] & 0x80) ++n;
+			return n;
+		}
+
+		template<typename R> uint64_t unpack(R& r)
+		{
+			if(r.size() >= 10)
+			{
+				uint64_t v;
+				r.view(decode(r.data(), v) - r.data());
+				return v;
+			}
+			uint64_t v = 0;
+			for(unsigned shift = 0; shift < 70; shift += 7)
+			{
+				uint8_t b = r.template unpack<uint8_t>();
+				v |= uint64_t(b & 0x7f) << shift;
+				if(!(b & 0x80)) break;
+			}
+			return v;
+		}
+
+		template<typename R> void skip(R& r)
+		{
+			if(r.size() >= 10) return (void)r.view(length(r.data()));
+			for(unsigned shift = 0; shift < 70 && r.template unpack<uint8_t>() & 0x80; shift += 7) {}
+		}
+
+		template<typename W> void packInto(W& w, uint64_t x)
+		{
+			w.writeBytes(byteLength(x), [x](char* p) mutable
+			{
+				for(; x >= 0x80; x >>= 7) *p++ = char(x | 0x80);
+				*p = char(x);
+			});
+		}
+	};
+
+	// Signed values are zigzag encoded first, 0, -1, 1, -2 ... become 0, 1, 2, 3 ...,
+	// so that small negative values are short too.
+	template<typename T> struct Type<Var<T>>
+	{
+		static constexpr size_t fixedBytes = variable;
+		static constexpr size_t fixedBits = variable;
+		static constexpr size_t minBits = 8;
+		static std::string toString(const Var<T>& x) { return std::to_string(x.value); }
+		static size_t bitLength(const Var<T>& x) { return 8*leb128::byteLength(encode(x)); }
+
+		static uint64_t encode(T x)
+		{
+			if constexpr(std::is_signed_v<T>) return (uint64_t(x) << 1) ^ uint64_t(int64_t(x) >> 63);
+			else return x;
+		}
+
+		static T decode(uint64_t x)
+		{
+			if constexpr(std::is_signed_v<T>) return T((x >> 1) ^ (0 - (x & 1)));
+			else return T(x);
+		}
+
+		template<typename R> static Var<T> unpack(R& r) { return decode(leb128::unpack(r)); }
+		template<typename R> static void skip(R& r) { leb128::skip(r); }
+		template<typename W> static void packInto(W& w, const Var<T>& x) { leb128::packInto(w, encode(x)); }
+
+		// Decodes the len values of a list, which take at least a byte each, in one loop over the range.
+		template<typename R, typename V> static void unpackList(R& r, size_t len, V& x)
+		{
+			x.resize(len);
+			size_t i = 0;
+			const char* p = r.data();
+			for(const char* end = p + r.size(); i < len && end - p >= 10; ++i)
+			{
+				uint64_t v;
+				p = leb128::decode(p, v);
+				x[i] = decode(v);
+			}
+			r.view(p - r.data());
+			for(; i < len; ++i) x[i] = unpack(r);
+		}
+	};
+
+	template<typename S> struct StringType
+	{
+		static constexpr size_t fixedBytes = variable;
+		static constexpr size_t fixedBits = variable;
+		static constexpr size_t minBits = varint::minBits;
+		static std::string toString(const S& x) { return '\'' + std::string(x.begin(), x.end()) + '\''; }
+		static size_t bitLength(const S& x) { return varint::bitLength(x.size()) + 8*x.size(); }
+
+		// views borrow the bytes, owning strings copy them piece by piece from a streaming reader
+		template<typename R> static S unpack(R& r)
+		{
+			if constexpr(std::is_trivially_copyable_v<S>)
+			{
+				std::string_view v = r.view(varint::unpack(r));
+				return S(v.data(), v.size());
+			}
+			else
+			{
+				S x(allocator<typename S::allocator_type>(r));
+				unpackInto(r, x);
+				return x;
+			}
+		}
+
+		template<typename R> static void unpackInto(R& r, S& x)
+		{
+			if constexpr(std::is_trivially_copyable_v<S>) x = unpack(r);
+			else
+			{
+				size_t len = varint::unpack(r);
+				size_t n = r.template allocate<uint8_t>(len);
+				if(r.failed()) len = 0;
+				x.clear();
+				x.reserve(n);
+				r.readChunks(len, [&](std::string_view v) { x.append(v.data(), v.size()); });
+			}
+		}
+
+		template<typename R> static void skip(R& r) { r.skipBytes(varint::unpack(r)); }
+
+		template<typename W> static void packInto(W& w, const S& x)
+		{
+			varint::packInto(w, x.size());
+			w.write(x.data(), x.size());
+		}
+	};
+
+	template<> struct Type<std::string> : StringType<std::string> {};
+	template<> struct Type<std::string_view> : StringType<std::string_view> {};
+	template<> struct Type<std::pmr::string> : StringType<std::pmr::string> {};
+
+	template<> struct Type<ByteView> : StringType<ByteView>
+	{
+		static std::string toString(const ByteView& x)
+		{
+			static const char digits[] = "0123456789abcdef";
+			std::string result = "<";
+			for(uint8_t b : x) (result += digits[b >> 4]) += digits[b & 15];
+			return result += '>';
+		}
+	};
+
+	// String packed once per message in the table of the enclosing WithStrings<T>, its occurrences
+	// as indices into the table. Outside of one and in indexed lists it is packed like a string.
+	// Interned<std::string_view> points into the unpacked buffer, so equal strings share their bytes,
+	// streaming readers fail to unpack it as their table is gone afterwards.
+	template<typename S> struct Interned : S
+	{
+		using S::S;
+		Interned() = default;
+		Interned(S s) : S(std::move(s)) {}
+	};
+
+	// Message whose interned strings are packed as a table of the distinct ones followed by the value.
+	template<typename T> struct WithStrings : T
+	{
+		WithStrings() = default;
+		WithStrings(T x) : T(std::move(x)) {}
+	};
+
+	template<typename S> constexpr bool isBorrowed<Interned<S>> = isBorrowed<S>;
+	template<typename T> constexpr bool isBorrowed<WithStrings<T>, std::enable_if_t<!isStruct<T>>> = isBorrowed<T>;
+
+	// Writer that collects the interned strings of a message into its table instead of packing them,
+	// whichever types they're held in. The bytes written go to a scratch buffer.
+	struct StringCollector : BitWriter<StringCollector>
+	{
+		explicit StringCollector(StringTable& t) : target(t) { table = &t; }
+
+		size_t size() const noexcept { return used; }
+		void write(const void*, size_t len) { grow(len); }
+
+		// Strings of nested messages, which have their own table or none, are left out.
+		template<typename S> void add(const S& s)
+		{
+			if(table != &target) return;
+			target.add(s);
+			whole += Type<S>::bitLength(s);
+			++count;
+		}
+
+		// Bits of the strings added when packed whole and how many were added.
+		size_t whole = 0, count = 0;
+
+	private:
+		friend BitWriter<StringCollector>;
+
+		char& at(size_t) { return scratch[0]; }
+
+		char* grow(size_t len)
+		{
+			if(scratch.size() < len) scratch.resize(len);
+			used += len;
+			return scratch.data();
+		}
+
+		StringTable& target;
+		std::vector<char> scratch = std::vector<char>(8);
+		size_t used = 0;
+	};
+
+	template<typename S> struct Type<Interned<S>>
+	{
+		static constexpr size_t fixedBytes = variable;
+		static constexpr size_t fixedBits = variable;
+		static std::string toString(const S& x) { return Type<S>::toString(x); }
+		static size_t bitLength(const S& x) { return Type<S>::bitLength(x); }
+
+		// indices into a table of at most one string take no bits
+		template<typename R> static size_t leastBits(const R& r)
+		{
+			const StringTable* t = r.strings();
+			return t ? t->bits : bw::minBits<S>;
+		}
+
+		template<typename R> static Interned<S> unpack(R& r)
+		{
+			const StringTable* t = r.strings();
+			if(!t) return Type<S>::unpack(r);
+			if(std::is_trivially_copyable_v<S> && r.streaming())
+			{
+				r.fail(Error::invalid, "Interned views can't be unpacked from a stream, their table is gone after unpacking");
+				return {};
+			}
+			uint32_t i = r.readBits(t->bits);
+			if(i >= t->strings.size())
+			{
+				r.fail(Error::invalid, "Invalid string index");
+				return {};
+			}
+			std::string_view v = t->strings[i];
+			if constexpr(std::is_trivially_copyable_v<S>) return S(v.data(), v.size());
+			else return S(v.data(), v.size(), allocator<typename S::allocator_type>(r));
+		}
+
+		template<typename R> static void skip(R& r)
+		{
+			if(const StringTable* t = r.strings()) r.skipBits(t->bits);
+			else Type<S>::skip(r);
+		}
+
+		template<typename W> static void packInto(W& w, const S& x)
+		{
+			if constexpr(std::is_same_v<W, StringCollector>) w.add(x);
+			else if(const StringTable* t = w.strings()) w.writeBits(t->index.at(x), t->bits);
+			else Type<S>::packInto(w, x);
+		}
+	};
+
+	template<typename T> struct Type<WithStrings<T>>
+	{
+		static constexpr size_t fixedBytes = variable;
+		static constexpr size_t fixedBits = variable;
+		static constexpr size_t minBits = varint::minBits + bw::minBits<T>;
+		static std::string toString(const T& x) { return bw::toString(x); }
+
+		static size_t bitLength(const T& x)
+		{
+			StringTable t;
+			StringCollector c(t);
+			c.pack(x);
+			seal(t);
+			size_t s = varint::bitLength(t.strings.size());
+			for(std::string_view v : t.strings) s += bw::bitLength(v);
+			return s + bw::bitLength(x) - c.whole + c.count*t.bits;
+		}
+
+		template<typename R> static WithStrings<T> unpack(R& r)
+		{
+			WithStrings<T> x;
+			unpackInto(r, x);
+			return x;
+		}
+
+		// the table is made of views into the range, which only have to outlive unpacking the value,
+		// or into copies if a streaming reader may refill its buffer meanwhile
+		template<typename R> static void unpackInto(R& r, T& x)
+		{
+			StringTable t;
+			std::deque<std::string> copies;
+			size_t len = varint::unpack(r);
+			t.strings.reserve(r.template allocate<std::string_view>(len));
+			for(size_t i = 0; i < len && !r.failed(); ++i)
+			{
+				if(r.streaming()) t.strings.push_back(copies.emplace_back(r.template unpack<std::string>()));
+				else t.strings.push_back(r.template unpack<std::string_view>());
+			}
+			seal(t);
+			const StringTable* outer = r.strings();
+			r.strings(&t);
+			r.unpackInto(x);
+			r.strings(outer);
+		}
+
+		template<typename R> static void skip(R& r)
+		{
+			StringTable t;
+			size_t len = varint::unpack(r);
+			for(size_t i = 0; i < len && !r.failed(); ++i) r.template skip<std::string_view>();
+			t.bits = len > 1 ? bitsNeeded(len - 1) : 0;
+			const StringTable* outer = r.strings();
+			r.strings(&t);
+			r.template skip<T>();
+			r.strings(outer);
+		}
+
+		template<typename W> static void packInto(W& w, const T& x)
+		{
+			StringTable t;
+			StringCollector(t).pack(x);
+			seal(t);
+			varint::packInto(w, t.strings.size());
+			for(std::string_view v : t.strings) w.pack(v);
+			const StringTable* outer = w.strings();
+			w.strings(&t);
+			w.pack(x);
+			w.strings(outer);
+		}
+
+	private:
+		static void seal(StringTable& t) { t.bits = t.strings.size() > 1 ? bitsNeeded(t.strings.size() - 1) : 0; }
+	};
+
+	template<typename T> struct Type<std::optional<T>>
+	{
+		static constexpr size_t fixedBytes = variable;
+		static constexpr size_t fixedBits = variable;
+		static constexpr size_t minBits = 1;
+		static std::string toString(const std::optional<T>& x) { return x ? bw::toString(*x) : "?"; }
+		static constexpr size_t bitLength(const std::optional<T>& x) { return 1 + (x ? bw::bitLength(*x) : 0); }
+		template<typename R> static std::optional<T> unpack(R& r) { return r.readBits(1) ? std::make_optional(r.template unpack<T>()) : std::nullopt; }
+
+		template<typename R> static void skip(R& r) { if(r.readBits(1)) r.template skip<T>(); }
+
+		template<typename R> static void unpackInto(R& r, std::optional<T>& x)
+		{
+			if(!r.readBits(1)) x.reset();
+			else if(x) r.unpackInto(*x);
+			else x = r.template unpack<T>();
+		}
+
+		template<typename W> static void packInto(W& w, const std::optional<T>& x)
+		{
+			w.writeBits(bool(x), 1);
+			if(x) w.pack(*x);
+		}
+	};
+
+	// Lists of such elements are read and written as a single run of bits.
+	template<typename T> constexpr bool isBitsOnly = isFixed<T> && !fixedBytes<T> && fixedBits<T> && fixedBits<T> <= 32;
+
+	// Structs of up to 8 byte-sized bit fields are split into their fields with one BMI2 deposit,
+	// spreading each field to a byte of its own, and gathered back with one extract.
+	template<typename T, typename = void> constexpr uint8_t byteFieldBits = 0;
+	template<typename T> constexpr uint8_t byteFieldBits<T, std::void_t<decltype(Type<T>::bits)>> = sizeof(T) == 1 ? Type<T>::bits : 0;
+
+	template<typename... A> constexpr uint64_t byteFieldsMask(std::tuple<A...>*)
 	{
-		Reader(const char* from, const char* to) noexcept : from(from), to(to) {}
-		Reader(std::string_view src) noexcept : from(src.data()), to(src.data() + src.size()) {}
-		Reader(const std::vector<char>& src) noexcept : from(src.data()), to(src.data() + src.size()) {}
+		if constexpr(!sizeof...(A) || sizeof...(A) > 8 || !(byteFieldBits<A> && ...)) return 0;
+		else
+		{
+			uint8_t bits[] = {byteFieldBits<A>...};
+			uint64_t mask = 0;
+			for(size_t i = 0; i < sizeof...(A); ++i) mask |= ((uint64_t(1) << bits[i]) - 1) << 8*i;
+			return mask;
+		}
+	}
 
-		size_t size() const noexcept { return to - from; }
+	template<typename T, typename = void> constexpr uint64_t depositMask = 0;
+	template<typename T> constexpr uint64_t depositMask<T, std::enable_if_t<isStruct<T>>> =
+		byteFieldsMask((typename Type<decltype(~std::declval<const T&>())>::Values*)nullptr);
 
-		void read(void* dest, size_t len)
+	template<typename T> T fromBits(uint64_t bits)
+	{
+#ifdef __BMI2__
+		if constexpr(depositMask<T> != 0)
 		{
-			if(len > size()) throw std::range_error("Insufficient bytes in range");
-			memcpy(dest, from, len);
-			from += len;
+			uint64_t bytes = _pdep_u64(bits, depositMask<T>);
+			T x;
+			std::apply([&](auto&... f) { int i = 0; ((f = static_cast<std::decay_t<decltype(f)>>(uint8_t(bytes >> 8*i++))), ...); }, ~x);
+			return x;
 		}
+#endif
+		WordReader r{bits};
+		return Type<T>::unpack(r);
+	}
 
-		uint32_t readBits(uint8_t count)
+	template<typename T> uint64_t toBits(const T& x)
+	{
+#ifdef __BMI2__
+		if constexpr(depositMask<T> != 0)
 		{
-			uint32_t result = 0;
-			uint8_t pos = 0;
-			while(count)
-			{
-				if(!bitsLeft)
-				{
-					read(&bits, 1);
-					bitsLeft = 8;
-				}
-				uint8_t bitsToRead = std::min(bitsLeft, count);
-				uint8_t mask = (uint32_t(1) << bitsToRead) - 1;
-				result |= (mask & bits) << pos;
-				pos += bitsToRead;
-				count -= bitsToRead;
-				bitsLeft -= bitsToRead;
-				bits >>= bitsToRead;
-			}
-			return result;
+			uint64_t bytes = 0;
+			std::apply([&](const auto&... f) { int i = 0; ((bytes |= uint64_t(static_cast<uint8_t>(f)) << 8*i++), ...); }, ~x);
+			return _pext_u64(bytes, depositMask<T>);
 		}
+#endif
+		WordWriter w;
+		w.pack(x);
+		return w.bits;
+	}
 
-		template<typename T> auto unpack() { return Type<std::decay_t<T>>::unpack(*this); }
+	template<typename T, typename A> struct Type<std::vector<T, A>>
+	{
+		using V = std::vector<T, A>;
 
-	private:
-		const char* from;
-		const char* to;
-		uint8_t bits;
-		uint8_t bitsLeft = 0;
-	};
+		static constexpr size_t fixedBytes = variable;
+		static constexpr size_t fixedBits = variable;
+		static constexpr size_t minBits = varint::minBits;
 
-	struct Writer
-	{
-		Writer(std::vector<char>& dest) noexcept : dest(dest) {}
+		static std::string toString(const V& x)
+		{
+			std::string result = "[ ";
+			for(const auto& m : x) result += bw::toString(m) += ' ';
+			return result += ']';
+		}
 
-		void write(const void* src, size_t len)
+		static size_t bitLength(const V& x)
 		{
-			dest.insert(dest.end(), (const char*)src, (const char*)src + len);
+			size_t s = varint::bitLength(x.size());
+			if constexpr(isFixed<T>) return s + x.size()*fixedBitLength<T>;
+			for(const T& m : x) s += bw::bitLength(m);
+			return s;
 		}
 
-		void writeBits(uint32_t bits, uint8_t count)
+		template<typename R> static V unpack(R& r)
+		{
+			V x(allocator<A>(r));
+			unpackInto(r, x);
+			return x;
+		}
+
+		// Elements already in x are unpacked into. The length is checked against the range and the
+		// budget of the reader before the list is reserved.
+		template<typename R> static void unpackInto(R& r, V& x)
 		{
-			while(count)
+			size_t len = varint::unpack(r);
+			size_t n = r.template allocate<T>(len);
+			if(r.failed()) len = 0;
+			if constexpr(isFixed<T>)
 			{
-				if(!bitsLeft)
+				x.clear();
+				x.reserve(n);
+				// one check per batch, which is the whole list unless a streaming reader has to refill
+				for(size_t i = 0, n; i < len; i += n)
 				{
-					bitsPos = dest.size();
-					dest.push_back(0);
-					bitsLeft = 8;
+					if(!(n = r.template fitting<T>(len - i))) break;
+					UncheckedReader u(r);
+					x.resize(i + n);
+					if constexpr(std::is_base_of_v<NumberType<T>, Type<T>>) memcpy(x.data() + i, u.view(n*sizeof(T)).data(), n*sizeof(T));
+					else if constexpr(isBitsOnly<T>)
+					{
+						size_t j = i;
+						u.readBitsRun(n, bw::fixedBits<T>, [&](uint64_t bits) { x[j++] = fromBits<T>(bits); });
+					}
+					else for(size_t j = i; j < i + n; ++j) x[j] = Type<T>::unpack(u);
+					r = R(u);
 				}
-				uint8_t bitsToWrite = std::min(bitsLeft, count);
-				uint8_t mask = (uint32_t(1) << bitsToWrite) - 1;
-				dest[bitsPos] |= (mask & bits) << (8 - bitsLeft);
-				bitsLeft -= bitsToWrite;
-				count -= bitsToWrite;
-				bits >>= bitsToWrite;
+			}
+			else
+			{
+				if constexpr(isVar<T>) if(len <= r.size()) return Type<T>::unpackList(r, len, x);
+				if(len < x.size()) x.resize(len);
+				x.reserve(n);
+				for(auto& m : x) r.unpackInto(m);
+				while(x.size() < len && !r.failed()) x.push_back(r.template unpack<T>());
 			}
 		}
 
-		template<typename T> void pack(const T& x) { Type<std::decay_t<T>>::packInto(*this, x); }
+		// Lists of elements made only of bytes or only of bits are skipped without reading them.
+		template<typename R> static void skip(R& r)
+		{
+			size_t len = varint::unpack(r);
+			if constexpr(isFixed<T>)
+			{
+				for(size_t i = 0, n; i < len; i += n)
+				{
+					if(!(n = r.template fitting<T>(len - i))) break;
+					UncheckedReader u(r);
+					if constexpr(!bw::fixedBits<T>) u.skipBytes(n*bw::fixedBytes<T>);
+					else if constexpr(!bw::fixedBytes<T>) u.skipBits(n*bw::fixedBits<T>);
+					else for(size_t j = 0; j < n; ++j) Type<T>::skip(u);
+					r = R(u);
+				}
+			}
+			else for(size_t i = 0; i < len && !r.failed(); ++i) r.template skip<T>();
+		}
 
-	private:
-		std::vector<char>& dest;
-		size_t bitsPos;
-		uint8_t bitsLeft = 0;
+		template<typename W> static void packInto(W& w, const V& x)
+		{
+			varint::packInto(w, x.size());
+			if constexpr(std::is_base_of_v<NumberType<T>, Type<T>>) w.write(x.data(), x.size()*sizeof(T));
+			else if constexpr(isBitsOnly<T>)
+			{
+				// runs continue each other's bit groups, splitting bounds the bytes a run grows at once
+				for(size_t i = 0, n; i < x.size(); i += n)
+				{
+					n = std::min<size_t>(x.size() - i, 1 << 16);
+					w.writeBitsRun(n, bw::fixedBits<T>, [&](size_t j) { return toBits<T>(x[i + j]); });
+				}
+			}
+			else if constexpr(isFixed<T> && !bw::fixedBits<T>)
+			{
+				// elements made of bytes only are written unchecked, a chunk at a time
+				for(size_t i = 0, n; i < x.size(); i += n)
+				{
+					n = std::min<size_t>(x.size() - i, 1 << 12);
+					w.writeBytes(n*bw::fixedBytes<T>, [&](char* p)
+					{
+						BufferWriter b(p, n*bw::fixedBytes<T>);
+						for(size_t j = i; j < i + n; ++j) b.pack(x[j]);
+					});
+				}
+			}
+			else for(const auto& v : x) w.pack(v);
+		}
 	};
 
-	constexpr uint8_t bitsNeeded(size_t max) { return 32 - __builtin_clz(max); }
-	template<typename T> std::string toString(const T& x) { return Type<std::decay_t<T>>::toString(x); }
-	template<typename T> constexpr size_t bitLength(const T& x) { return Type<std::decay_t<T>>::bitLength(x); }
-	template<typename T> constexpr size_t byteLength(const T& x) { return (bitLength(x) + 7)/8; }
-	template<typename T> T unpack(const std::vector<char>& buf) { return Reader(buf).unpack<T>(); }
+	template<typename T> struct ListView;
 
-	template<typename T> std::vector<char> pack(const T& x)
+	// List encoded with the end offsets of its elements, each a nested message, so that any of them
+	// can be read on its own (see ListView). Layout: varint count, count uint32 end offsets relative
+	// to the first element, the elements.
+	template<typename T, typename A = std::allocator<T>> struct IndexedList : std::vector<T, A>
 	{
-		std::vector<char> r;
-		r.reserve(byteLength(x));
-		Writer(r).pack(x);
-		return r;
+		using std::vector<T, A>::vector;
+	};
+
+	namespace pmr
+	{
+		template<typename T> using IndexedList = bw::IndexedList<T, std::pmr::polymorphic_allocator<T>>;
 	}
 
-	inline float asFloat(uint32_t x) { float f; memcpy(&f, &x, sizeof(x)); return f; }
-	inline float scale(float v, float vmin, float vmax, float min, float max) { return (v - vmin)/(vmax - vmin)*(max - min) + min; }
+	template<typename T, typename A> constexpr bool isBorrowed<IndexedList<T, A>> = isBorrowed<T>;
 
-	template<typename U, uint32_t Min, uint32_t Max> struct Scaled
+	template<typename T, typename A> struct Type<IndexedList<T, A>>
 	{
-		U value;
-		Scaled() {}
-		Scaled(float v) { *this = v; }
-		explicit Scaled(U value) : value(value) {}
-		static float min() { return asFloat(Min); }
-		static float max() { return asFloat(Max); }
-		operator float() const { return scale(value, std::numeric_limits<U>::min(), std::numeric_limits<U>::max(), min(), max()); }
-		auto& operator=(float v) { value = scale(v, min(), max(), std::numeric_limits<U>::min(), std::numeric_limits<U>::max()); return *this; }
+		using L = IndexedList<T, A>;
+
+		static constexpr size_t fixedBytes = variable;
+		static constexpr size_t fixedBits = variable;
+		static constexpr size_t minBits = varint::minBits;
+		static std::string toString(const L& x) { return Type<std::vector<T, A>>::toString(x); }
+
+		static size_t bitLength(const L& x)
+		{
+			size_t s = varint::bitLength(x.size()) + 32*x.size();
+			for(const T& m : x) s += 8*byteLength(m);
+			return s;
+		}
+
+		template<typename R> static L unpack(R& r)
+		{
+			L x(allocator<A>(r));
+			unpackInto(r, x);
+			return x;
+		}
+
+		template<typename R> static void unpackInto(R& r, L& x)
+		{
+			size_t len = varint::unpack(r);
+			// elements of vector<bool> share their bytes, so can't be assigned from several threads
+			if constexpr(std::is_same_v<R, Reader> && !std::is_same_v<T, bool>)
+			{
+				ThreadPool* pool = r.pool();
+				if(pool && pool->size() > 1 && len >= pool->threshold) return unpackParallel(r, len, *pool, x);
+			}
+			r.skipBytes(std::min(len, std::numeric_limits<size_t>::max()/sizeof(uint32_t))*sizeof(uint32_t));
+			size_t n = r.template allocate<T>(len);
+			if(r.failed()) len = 0;
+			if constexpr(isFixed<T>) x.clear();
+			else
+			{
+				if(len < x.size()) x.resize(len);
+				for(auto& m : x) r.nested([&] { r.unpackInto(m); });
+			}
+			x.reserve(n);
+			while(x.size() < len && !r.failed()) r.nested([&] { x.push_back(r.template unpack<T>()); });
+		}
+
+		// Chunks of elements are unpacked into x by the pool, the readers over them have no pool set
+		// so nested lists are unpacked by the thread of their chunk. If r has a budget, they all
+		// charge it through a shared one.
+		static void unpackParallel(Reader& r, size_t len, ThreadPool& pool, L& x)
+		{
+			r.allocate<T>(len);
+			ListView<T> v(r, len);
+			x.resize(len);
+			size_t chunks = std::min(len, 4*pool.size());
+			std::atomic<size_t> own(r.budget());
+			std::atomic<size_t>& left = r.sharedBudget() ? *r.sharedBudget() : own;
+			pool.run(chunks, [&](size_t c)
+			{
+				for(size_t i = len*c/chunks; i < len*(c + 1)/chunks; ++i)
+				{
+					Reader e = v.at(i);
+					if(r.budgeted()) e.budget(left);
+					e.unpackInto(x[i]);
+				}
+			});
+			if(r.budgeted() && !r.sharedBudget()) r.budget(own.load());
+		}
+
+		// Elements don't share bit groups, so chunks of them are packed by the pool straight into
+		// their place in the output, a window of at most 4 MiB at a time. Nested lists are packed by
+		// the thread of their chunk.
+		template<typename W> static void packParallel(W& w, const L& x, ThreadPool& pool)
+		{
+			size_t len = x.size(), chunks = std::min(len, 4*pool.size());
+			std::vector<size_t> ends(len);
+			pool.run(chunks, [&](size_t c)
+			{
+				for(size_t i = len*c/chunks; i < len*(c + 1)/chunks; ++i) ends[i] = byteLength(x[i]);
+			});
+			for(size_t i = 0, end = 0; i < len; ++i)
+			{
+				if((end += ends[i]) > std::numeric_limits<uint32_t>::max()) throw std::range_error("Indexed list too long");
+				ends[i] = end;
+			}
+
+			varint::packInto(w, len);
+			for(size_t end : ends) w.template pack<uint32_t>(end);
+			w.nested([&]
+			{
+				for(size_t i = 0, n; i < len; i += n)
+				{
+					size_t base = i ? ends[i - 1] : 0;
+					for(n = 1; i + n < len && ends[i + n] - base <= 1 << 22; ++n) {}
+					w.writeBytes(ends[i + n - 1] - base, [&](char* p)
+					{
+						pool.run(std::min(n, chunks), [&, m = std::min(n, chunks)](size_t c)
+						{
+							size_t a = i + n*c/m, b = i + n*(c + 1)/m;
+							size_t from = a ? ends[a - 1] : 0;
+							BufferWriter u(p + (from - base), ends[b - 1] - from);
+							for(size_t j = a; j < b; ++j) u.nested([&] { u.pack(x[j]); });
+						});
+					});
+				}
+			});
+		}
+
+		template<typename R> static void skip(R& r)
+		{
+			size_t len = varint::unpack(r);
+			if(!len) return;
+			r.skipBytes(std::min(len - 1, std::numeric_limits<size_t>::max()/sizeof(uint32_t))*sizeof(uint32_t));
+			r.skipBytes(r.template unpack<uint32_t>());
+		}
+
+		template<typename W> static void packInto(W& w, const L& x)
+		{
+			ThreadPool* pool = w.pool();
+			if(pool && pool->size() > 1 && x.size() >= pool->threshold) return packParallel(w, x, *pool);
+			varint::packInto(w, x.size());
+			uint64_t end = 0;
+			for(const T& m : x)
+			{
+				if((end += byteLength(m)) > std::numeric_limits<uint32_t>::max()) throw std::range_error("Indexed list too long");
+				w.template pack<uint32_t>(end);
+			}
+			for(const T& m : x) w.nested([&] { w.pack(m); });
+		}
 	};
 
-	template<typename T> struct Type
+	template<typename... Args> struct Type<std::tuple<Args...>>
 	{
-		static std::string toString(const T& x) { return bw::toString(~x); }
-		static constexpr size_t bitLength(const T& x) { return bw::bitLength(~x); }
-		static T unpack(Reader& r) { return Type<decltype(~std::declval<T>())>::template unpackAs<T>(r); }
-		static void packInto(Writer& w, const T& x) { w.pack(~x); }
+		static constexpr size_t fixedBytes = (isFixed<Args> && ...) ? (bw::fixedBytes<Args> + ... + 0) : variable;
+		static constexpr size_t fixedBits = (isFixed<Args> && ...) ? (bw::fixedBits<Args> + ... + 0) : variable;
+		static constexpr size_t minBits = (bw::minBits<std::decay_t<Args>> + ... + 0);
+		static std::string toString(const std::tuple<Args...>& x) { return std::apply([](const auto&... args) { return "( " + ((bw::toString(args) + ' ') + ...) + ')'; }, x); }
+		static constexpr size_t bitLength(const std::tuple<Args...>& x) { return std::apply([](const auto&... args) { return (bw::bitLength(args) + ...); }, x); }
+		using Values = std::tuple<std::decay_t<Args>...>;
+		template<typename T, typename R> static T unpackAs(R& r) { return T{r.template unpack<Args>()...}; }
+		template<typename R> static auto unpack(R& r) { return unpackAs<Values>(r); }
+		template<typename R, typename X> static void unpackInto(R& r, X&& x) { std::apply([&](auto&... args) { (r.unpackInto(args), ...); }, x); }
+		template<typename R> static void skip(R& r) { (r.template skip<Args>(), ...); }
+		template<typename W> static void packInto(W& w, const std::tuple<Args...>& x) { std::apply([&](const auto&... args) { (w.pack(args), ...); }, x); }
 	};
 
-	template<typename U, uint32_t Min, uint32_t Max> struct Type<Scaled<U, Min, Max>>
+	// Packed T decoded on demand, member I is reached by skipping the members before it.
+	template<typename T> struct View
 	{
-		using T = Scaled<U, Min, Max>;
-		static std::string toString(const T& x) { return std::to_string((float)x); }
-		static constexpr size_t bitLength(const T& x) { return bw::bitLength(x.value); }
-		static T unpack(Reader& r) { return T(r.unpack<U>()); }
-		static void packInto(Writer& w, const T& x) { w.pack<U>(x.value); }
+		using Fields = typename Type<decltype(~std::declval<const T&>())>::Values;
+
+		View(Reader r) noexcept : r(r) {}
+
+		template<size_t I> Reader at() const
+		{
+			Reader x = r;
+			skipFields(x, std::make_index_sequence<I>());
+			return x;
+		}
+
+		template<size_t I> auto get() const { return at<I>().template unpack<std::tuple_element_t<I, Fields>>(); }
+		T unpack() const { return Reader(r).unpack<T>(); }
+
+	private:
+		template<size_t... I> static void skipFields(Reader& r, std::index_sequence<I...>) { (skip<std::tuple_element_t<I, Fields>>(r), ...); }
+
+		Reader r;
 	};
 
-	template<typename T, uint8_t Bits> struct BitsType
+	// Elements of a packed IndexedList<T>, each one is unpacked without reading the others.
+	template<typename T> struct ListView
 	{
-		static constexpr uint8_t bits = Bits;
-		static constexpr size_t bitLength(const T&) { return bits; }
-		static bool unpack(Reader& r) { return static_cast<T>(r.readBits(bits)); }
-		static void packInto(Writer& w, const T& x) { w.writeBits(static_cast<uint32_t>(x), bits); }
+		ListView(Reader r) : ListView(r, varint::unpack(r)) {}
+
+		// List of count elements whose table comes next in r, r moves past the list.
+		ListView(Reader& r, size_t count) : count(count), memory(r.resource())
+		{
+			if(count > r.size()/sizeof(uint32_t)) throw std::range_error("Insufficient bytes in range");
+			table = r.view(count*sizeof(uint32_t)).data();
+			data = r.view(count ? end(count - 1) : 0).data();
+		}
+
+		size_t size() const noexcept { return count; }
+
+		// Reader over element i, an unpacked T or the View of a struct can be made from it.
+		Reader at(size_t i) const
+		{
+			if(i >= count) throw std::out_of_range("List element out of range");
+			size_t from = i ? end(i - 1) : 0, to = end(i);
+			if(from > to || to > end(count - 1)) throw std::range_error("Invalid list index");
+			Reader r(data + from, data + to);
+			r.resource(memory);
+			return r;
+		}
+
+		T operator[](size_t i) const { return at(i).template unpack<T>(); }
+
+	private:
+		size_t end(size_t i) const { uint32_t x; memcpy(&x, table + i*sizeof(x), sizeof(x)); return x; }
+
+		size_t count;
+		std::pmr::memory_resource* memory;
+		const char* table;
+		const char* data;
 	};
 
-	template<typename T, int Count> struct EnumType : BitsType<T, bitsNeeded(Count - 1)>
+	// Changes from a previous value, see packDelta(). Values other than structs, lists and
+	// optionals are compared with == and packed whole when they changed.
+	template<typename T> struct WholeDelta
 	{
-		static constexpr int count = Count;
+		static bool same(const T& a, const T& b) { return a == b; }
+		template<typename W> static void packInto(W& w, const T&, const T& x) { w.pack(x); }
+		template<typename R> static void apply(R& r, T& x) { r.unpackInto(x); }
 	};
 
-	template<> struct Type<bool> : BitsType<bool, 1>
+	template<typename T, typename = void> struct Delta : WholeDelta<T> {};
+
+	template<typename T> struct Delta<std::optional<T>> : WholeDelta<std::optional<T>>
 	{
-		static std::string toString(const bool& x) { return x ? "+" : "-"; }
+		static bool same(const std::optional<T>& a, const std::optional<T>& b) { return a && b ? Delta<T>::same(*a, *b) : !a == !b; }
 	};
 
-	template<typename T> struct NumberType
+	// A bit per member telling if it changed, then the changes of the changed members.
+	template<typename T> struct Delta<T, std::enable_if_t<isStruct<T>>>
 	{
-		static std::string toString(const T& x) { return std::to_string(x); }
-		static constexpr size_t bitLength(const T&) { return 8*sizeof(T); }
-		static T unpack(Reader& r) { T x; r.read(&x, sizeof(T)); return x; }
-		static void packInto(Writer& w, const T& x) { w.write(&x, sizeof(T)); }
-	};
+		using Fields = typename Type<decltype(~std::declval<const T&>())>::Values;
+		static constexpr size_t count = std::tuple_size_v<Fields>;
+		using Members = std::make_index_sequence<count>;
 
-	template<> struct Type<int8_t> : NumberType<int8_t> {};
-	template<> struct Type<int16_t> : NumberType<int16_t> {};
-	template<> struct Type<int32_t> : NumberType<int32_t> {};
-	template<> struct Type<int64_t> : NumberType<int64_t> {};
-	template<> struct Type<uint8_t> : NumberType<uint8_t> {};
-	template<> struct Type<uint16_t> : NumberType<uint16_t> {};
-	template<> struct Type<uint32_t> : NumberType<uint32_t> {};
-	template<> struct Type<uint64_t> : NumberType<uint64_t> {};
-	template<> struct Type<float> : NumberType<float> {};
+		static bool same(const T& a, const T& b) { return same(~a, ~b, Members()); }
+		template<typename W> static void packInto(W& w, const T& prev, const T& x) { packInto(w, ~prev, ~x, Members()); }
+		template<typename R> static void apply(R& r, T& x) { apply(r, ~x, Members()); }
 
-	namespace varint
-	{
-		static constexpr uint8_t bytesBitsNeeded(size_t v) { return v <= 0xffff ? (v <= 0xff ? 0 : 1) : (v <= 0xffffffff ? 2 : 3); }
-		static constexpr size_t bitLength(size_t x) { return 2 + 8*(size_t(1) << bytesBitsNeeded(x)); }
+	private:
+		template<size_t I> using Member = Delta<std::tuple_element_t<I, Fields>>;
 
-		static size_t unpack(Reader& r)
+		template<typename X, size_t... I> static bool same(const X& a, const X& b, std::index_sequence<I...>)
 		{
-			switch(r.readBits(2))
-			{
-				case 0: return r.unpack<uint8_t>();
-				case 1: return r.unpack<uint16_t>();
-				case 2: return r.unpack<uint32_t>();
-			}
-			return r.unpack<uint64_t>();
+			return (Member<I>::same(std::get<I>(a), std::get<I>(b)) && ...);
 		}
 
-		static void packInto(Writer& w, size_t x)
+		template<typename W, typename X, size_t... I> static void packInto(W& w, const X& prev, const X& x, std::index_sequence<I...>)
 		{
-			uint8_t bb = bytesBitsNeeded(x);
-			w.writeBits(bb, 2);
-			switch(bb)
-			{
-				case 0: return Type<uint8_t>::packInto(w, x);
-				case 1: return Type<uint16_t>::packInto(w, x);
-				case 2: return Type<uint32_t>::packInto(w, x);
-				case 3: return Type<uint64_t>::packInto(w, x);
-			}
+			std::array<bool, count> changed{!Member<I>::same(std::get<I>(prev), std::get<I>(x))...};
+			for(bool c : changed) w.writeBits(c, 1);
+			((changed[I] ? Member<I>::packInto(w, std::get<I>(prev), std::get<I>(x)) : void()), ...);
+		}
+
+		template<typename R, typename X, size_t... I> static void apply(R& r, X x, std::index_sequence<I...>)
+		{
+			std::array<bool, count> changed;
+			for(bool& c : changed) c = r.readBits(1);
+			((changed[I] ? Member<I>::apply(r, std::get<I>(x)) : void()), ...);
 		}
 	};
 
-	template<> struct Type<std::string>
+	// The new length, a bit per element present in both lists telling if it changed, the changes
+	// of the changed ones and then the added elements whole. Lists of bool are packed whole.
+	template<typename T, typename A> struct Delta<std::vector<T, A>, std::enable_if_t<!std::is_same_v<T, bool>>>
 	{
-		static std::string toString(const std::string& x) { return '\'' + x + '\''; }
-		static size_t bitLength(const std::string& x) { return varint::bitLength(x.size()) + 8*x.size(); }
+		using V = std::vector<T, A>;
 
-		static std::string unpack(Reader& r)
+		static bool same(const V& a, const V& b)
 		{
-			size_t len = varint::unpack(r);
-			std::string x;
-			char s[1024];
-			while(len)
-			{
-				size_t n = std::min(len, sizeof(s));
-				r.read(s, n);
-				x.insert(x.end(), s, s + n);
-				len -= n;
-			}
-			return x;
+			if(a.size() != b.size()) return false;
+			for(size_t i = 0; i < a.size(); ++i) if(!Delta<T>::same(a[i], b[i])) return false;
+			return true;
 		}
 
-		static void packInto(Writer& w, const std::string& x)
+		template<typename W> static void packInto(W& w, const V& prev, const V& x)
 		{
 			varint::packInto(w, x.size());
-			w.write(x.data(), x.size());
+			size_t common = std::min(prev.size(), x.size());
+			std::vector<bool> changed(common);
+			for(size_t i = 0; i < common; ++i) w.writeBits(changed[i] = !Delta<T>::same(prev[i], x[i]), 1);
+			for(size_t i = 0; i < common; ++i) if(changed[i]) Delta<T>::packInto(w, prev[i], x[i]);
+			for(size_t i = common; i < x.size(); ++i) w.pack(x[i]);
+		}
+
+		template<typename R> static void apply(R& r, V& x)
+		{
+			size_t len = varint::unpack(r);
+			size_t n = r.template allocate<T>(len);
+			size_t common = std::min(len, x.size());
+			std::vector<bool> changed(common);
+			for(size_t i = 0; i < common; ++i) changed[i] = r.readBits(1);
+			x.resize(common);
+			x.reserve(n);
+			for(size_t i = 0; i < common; ++i) if(changed[i]) Delta<T>::apply(r, x[i]);
+			while(x.size() < len) x.push_back(r.template unpack<T>());
 		}
 	};
 
-	template<typename T> struct Type<std::optional<T>>
+	// Packs the changes from prev to x in a single pass, applyDelta(prev, ...) makes prev equal to x.
+	// Unchanged values take a bit, or nothing if they are part of a changed nested list or struct.
+	template<typename T> std::vector<char> packDelta(const T& prev, const T& x)
 	{
-		static std::string toString(const std::optional<T>& x) { return x ? bw::toString(*x) : "?"; }
-		static constexpr size_t bitLength(const std::optional<T>& x) { return 1 + (x ? bw::bitLength(*x) : 0); }
-		static std::optional<T> unpack(Reader& r) { return r.readBits(1) ? std::make_optional(r.unpack<T>()) : std::nullopt; }
+		std::vector<char> r;
+		{
+			GrowingWriter w(r);
+			Delta<T>::packInto(w, prev, x);
+		}
+		return r;
+	}
+
+	template<typename T> void applyDelta(T& prev, Reader r) { Delta<T>::apply(r, prev); }
+
+	// Archive: packed records back to back, then the index of their offsets as uint64 values, the
+	// number of records as uint64 and archiveMagic. Record i ends where record i + 1 or the index begins.
+	inline constexpr char archiveMagic[8] = {'b', 'w', 'i', 'n', 'd', 'e', 'x', '1'};
+
+	// Appends records to a stream starting at the beginning of the archive, close() writes the index.
+	struct ArchiveWriter
+	{
+		template<typename... A> explicit ArchiveWriter(A&&... a) : out(std::forward<A>(a)...) {}
+
+		size_t size() const noexcept { return offsets.size(); }
 
-		static void packInto(Writer& w, const std::optional<T>& x)
+		template<typename T> void append(const T& x)
 		{
-			w.writeBits(bool(x), 1);
-			if(x) w.pack(*x);
+			offsets.push_back(out.size());
+			out.pack(x);
+			out.finish();
+		}
+
+		void close()
+		{
+			uint64_t count = offsets.size();
+			out.write(offsets.data(), count*sizeof(uint64_t));
+			out.write(&count, sizeof(count));
+			out.write(archiveMagic, sizeof(archiveMagic));
+			out.flush();
 		}
+
+	private:
+		StreamWriter out;
+		std::vector<uint64_t> offsets;
 	};
 
-	template<typename T> struct Type<std::vector<T>>
+	// Random access to the records of an archive in memory or mapped from a file. Only the trailer
+	// is read up front, a record is located by reading its index entries when it's accessed.
+	struct ArchiveReader
 	{
-		static std::string toString(const std::vector<T>& x)
+		// Reads the archive in data, which has to outlive the reader.
+		static ArchiveReader fromBytes(std::string_view data) { return ArchiveReader(data, false, Check()); }
+
+#if __has_include(<sys/mman.h>)
+		// Maps the archive file at path.
+		static ArchiveReader open(const std::string& path) { return ArchiveReader(map(path.c_str()), true, Check()); }
+#endif
+
+		~ArchiveReader() { release(); }
+
+		// Moving takes over the mapping, the reader moved from is left empty.
+		ArchiveReader(ArchiveReader&& r) noexcept : data(std::exchange(r.data, {})), mapped(std::exchange(r.mapped, false)), count(std::exchange(r.count, 0)), index(r.index) {}
+		ArchiveReader& operator=(ArchiveReader&& r) noexcept
 		{
-			std::string result = "[ ";
-			for(const auto& m : x) result += bw::toString(m) += ' ';
-			return result += ']';
+			if(this == &r) return *this;
+			release();
+			data = std::exchange(r.data, {});
+			mapped = std::exchange(r.mapped, false);
+			count = std::exchange(r.count, 0);
+			index = r.index;
+			return *this;
 		}
 
-		static size_t bitLength(const std::vector<T>& x)
+		ArchiveReader(const ArchiveReader&) = delete;
+		ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+		size_t size() const noexcept { return count; }
+
+		Reader at(size_t i) const
 		{
-			size_t s = varint::bitLength(x.size());
-			for(const T& m : x) s += bw::bitLength(m);
-			return s;
+			if(i >= count) throw std::out_of_range("Archive record out of range");
+			uint64_t from, to = index;
+			memcpy(&from, data.data() + index + i*sizeof(uint64_t), sizeof(from));
+			if(i + 1 < count) memcpy(&to, data.data() + index + (i + 1)*sizeof(uint64_t), sizeof(to));
+			if(from > to || to > index) throw std::range_error("Invalid archive");
+			return Reader(data.data() + from, data.data() + to);
 		}
 
-		static std::vector<T> unpack(Reader& r)
+		template<typename T> T unpack(size_t i) const { return at(i).unpack<T>(); }
+		template<typename T> View<T> view(size_t i) const { return View<T>(at(i)); }
+
+	private:
+		// the data is checked in the body of a constructor delegating to one that doesn't check it,
+		// so a mapping is released if that throws
+		struct Check {};
+		ArchiveReader(std::string_view data, bool mapped, Check) : ArchiveReader(data, mapped) { readTrailer(); }
+		ArchiveReader(std::string_view data, bool mapped) noexcept : data(data), mapped(mapped) {}
+
+		void release() noexcept
 		{
-			size_t len = varint::unpack(r);
-			std::vector<T> x;
-			while(len--) x.push_back(r.unpack<T>());
-			return x;
+#if __has_include(<sys/mman.h>)
+			if(mapped) munmap(const_cast<char*>(data.data()), data.size());
+#endif
+			mapped = false;
 		}
 
-		static void packInto(Writer& w, const std::vector<T>& x)
+		void readTrailer()
 		{
-			varint::packInto(w, x.size());
-			for(const auto& v : x) w.pack(v);
+			uint64_t n;
+			if(data.size() < sizeof(n) + sizeof(archiveMagic) || memcmp(data.data() + data.size() - sizeof(archiveMagic), archiveMagic, sizeof(archiveMagic)))
+				throw std::range_error("Invalid archive");
+			memcpy(&n, data.data() + data.size() - sizeof(archiveMagic) - sizeof(n), sizeof(n));
+			if(n > (data.size() - sizeof(n) - sizeof(archiveMagic))/sizeof(uint64_t)) throw std::range_error("Invalid archive");
+			count = n;
+			index = data.size() - sizeof(archiveMagic) - sizeof(n) - count*sizeof(uint64_t);
 		}
-	};
 
-	template<typename... Args> struct Type<std::tuple<Args...>>
-	{
-		static std::string toString(const std::tuple<Args...>& x) { return std::apply([](const auto&... args) { return "( " + ((bw::toString(args) + ' ') + ...) + ')'; }, x); }
-		static constexpr size_t bitLength(const std::tuple<Args...>& x) { return std::apply([](const auto&... args) { return (bw::bitLength(args) + ...); }, x); }
-		template<typename T> static T unpackAs(Reader& r) { return T{r.unpack<Args>()...}; }
-		static auto unpack(Reader& r) { return unpackAs<std::tuple<std::decay_t<Args>...>>(r); }
-		static void packInto(Writer& w, const std::tuple<Args...>& x) { std::apply([&](const auto&... args) { (w.pack(args), ...); }, x); }
+#if __has_include(<sys/mman.h>)
+		static std::string_view map(const char* path)
+		{
+			int fd = ::open(path, O_RDONLY);
+			if(fd < 0) throw std::system_error(errno, std::generic_category(), path);
+			struct stat st;
+			void* p = fstat(fd, &st) ? MAP_FAILED : st.st_size ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+			int error = errno;
+			close(fd);
+			if(p == MAP_FAILED) throw std::system_error(error, std::generic_category(), path);
+			return std::string_view(static_cast<const char*>(p), st.st_size);
+		}
+#endif
+
+		std::string_view data;
+		bool mapped;
+		size_t count = 0;
+		size_t index = 0;
 	};
 }
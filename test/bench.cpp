@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <binarywheel.hpp>
+#include <testtypes.hpp>
+#include <benchtypes.hpp>
+
+using namespace std;
+
+// Results are printed as a JSON array with one object per line, in the same order on every run,
+// so that the output of two versions can be diffed. MB/s are of packed bytes for every operation.
+
+template<typename F> double bestNs(F&& f)
+{
+	auto best = chrono::nanoseconds::max();
+	for(int i = 0; i < 5; ++i)
+	{
+		auto start = chrono::steady_clock::now();
+		f();
+		best = min(best, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start));
+	}
+	return double(best.count());
+}
+
+void report(const char* name, const char* op, size_t messages, size_t bytes, double ns)
+{
+	static bool first = true;
+	printf("%s\n\t{\"name\": \"%s\", \"op\": \"%s\", \"messages\": %zu, \"bytes\": %zu, \"ns_per_message\": %.2f, \"mb_per_s\": %.1f}",
+		first ? "[" : ",", name, op, messages, bytes, ns/messages, bytes/ns*1e3);
+	first = false;
+}
+
+size_t sink = 0;
+
+// Runs every operation over all messages, returns whether they unpacked to what was packed.
+template<typename T> bool measure(const char* name, const vector<T>& messages)
+{
+	size_t bytes = 0;
+	for(const auto& m : messages) bytes += bw::byteLength(m);
+	auto run = [&](const char* op, auto&& f) { report(name, op, messages.size(), bytes, bestNs([&] { for(size_t i = 0; i < messages.size(); ++i) f(i); })); };
+
+	vector<vector<char>> packed(messages.size()), compressed(messages.size());
+	vector<T> unpacked(messages.size());
+	run("pack", [&](size_t i) { packed[i] = bw::pack(messages[i]); });
+	run("pack1", [&](size_t i) { packed[i] = bw::pack(messages[i], bw::singlePass); });
+	run("packz", [&](size_t i) { compressed[i] = bw::pack(messages[i], bw::compressed); });
+	run("unpack", [&](size_t i) { unpacked[i] = bw::Reader(packed[i]).unpack<T>(); });
+	run("tryunpack", [&](size_t i) { unpacked[i] = *bw::Reader(packed[i]).tryUnpack<T>(); });
+	run("unpackz", [&](size_t i) { unpacked[i] = bw::unpack<T>(compressed[i], bw::compressed); });
+	run("bitlength", [&](size_t i) { sink += bw::bitLength(messages[i]); });
+	run("tostring", [&](size_t i) { sink += bw::toString(messages[i]).size(); });
+
+	for(size_t i = 0; i < messages.size(); ++i) if(bw::pack(unpacked[i]) != packed[i]) return false;
+	return true;
+}
+
+bool measureParallel(const char* name, const vector<TestStruct>& x)
+{
+	bw::IndexedList<TestStruct> list(x.begin(), x.end()), unpacked;
+	bw::ThreadPool pool;
+	size_t bytes = bw::byteLength(list);
+	vector<char> buf;
+	report(name, "pack", 1, bytes, bestNs([&] { buf = bw::pack(list); }));
+	report(name, "packmt", 1, bytes, bestNs([&] { buf = bw::pack(list, pool); }));
+	report(name, "unpack", 1, bytes, bestNs([&] { unpacked = bw::Reader(buf).unpack<bw::IndexedList<TestStruct>>(); }));
+	report(name, "unpackmt", 1, bytes, bestNs([&]
+	{
+		bw::Reader r(buf);
+		r.pool(&pool);
+		unpacked = r.unpack<bw::IndexedList<TestStruct>>();
+	}));
+	return bw::pack(unpacked) == buf;
+}
+
+template<typename T> void fillDeep(T& x, size_t i)
+{
+	if constexpr(tuple_size_v<decltype(~x)> == 2)
+	{
+		x.id = uint32_t(i);
+		x.name = "leaf " + to_string(i);
+	}
+	else
+	{
+		x.id = uint16_t(i);
+		x.active = i % 2;
+		if(i % 3) x.tag = uint8_t(i);
+		fillDeep(x.child, i/2);
+	}
+}
+
+template<typename T, typename F> vector<T> makeMessages(size_t count, F&& f)
+{
+	vector<T> r(count);
+	for(size_t i = 0; i < count; ++i) f(r[i], i);
+	return r;
+}
+
+template<typename T, typename F> vector<vector<T>> makeLists(size_t count, size_t length, F&& f)
+{
+	return makeMessages<vector<T>>(count, [&](vector<T>& x, size_t i)
+	{
+		x.resize(length);
+		for(size_t j = 0; j < length; ++j) f(x[j], i*length + j);
+	});
+}
+
+int main()
+{
+	auto wide = makeMessages<bench::Wide>(1 << 16, [](bench::Wide& x, size_t i)
+	{
+		x = {uint32_t(i), uint32_t(i/4), i*0.5f, i*0.25f, 1.f, int16_t(i % 7 - 3), int16_t(i % 5 - 2), 0, uint16_t(i % 100), 50,
+			uint8_t(i % 60), uint8_t(i % 4), bench::Color(i % 4), i % 2 == 0, true, i % 10 == 0, float(i % 360), i % 10*1.f,
+			uint32_t(i*2654435761u), int32_t(i) - 30000, "unit " + to_string(i)};
+	});
+	auto deep = makeMessages<bench::Deep>(1 << 16, [](bench::Deep& x, size_t i) { fillDeep(x, i); });
+	auto tests = makeMessages<TestStruct>(1 << 14, [](TestStruct& x, size_t i)
+	{
+		Nested n{"nested "s + to_string(i), uint8_t(i), i % 2 ? optional<string>("o") : nullopt, i % 2 == 0, false, true};
+		x = {vector<Nested>(i % 16, n), true, uint8_t(i), "string "s + to_string(i), nullopt, false, 1, Enum::C, -1, true,
+			vector<string>(i % 8, "s"), 1.5f, n};
+	});
+	auto cells = makeLists<bench::Cell>(256, 4096, [](bench::Cell& x, size_t i)
+	{
+		x = {bench::CellTerrain(i % 5), bench::Color(i/7 % 4), uint8_t(i % 8), i % 3 != 0, i % 5 == 0};
+	});
+	auto enums = makeLists<EnumStruct>(256, 4096, [](EnumStruct& x, size_t i)
+	{
+		x = {EnumStructE1(i % 2), EnumStructE2(i % 3), EnumStructE3(i % 6), EnumStructE4(i % 9)};
+	});
+	auto numbers = makeLists<NumStruct>(256, 4096, [](NumStruct& x, size_t i)
+	{
+		x = {int16_t(i), uint16_t(i), int32_t(i), uint32_t(i), i % 100/100.f, i % 1000/1000.f};
+	});
+	auto varints = makeLists<bw::Var<int32_t>>(256, 4096, [](bw::Var<int32_t>& x, size_t i) { x = int32_t(i % 2 ? i % 1000 : -int32_t(i % 100)); });
+	auto strings = makeLists<string>(256, 1024, [](string& x, size_t i) { x = (i % 3 ? "item " : "a somewhat longer item ") + to_string(i); });
+	auto floats = makeLists<float>(256, 4096, [](float& x, size_t i) { x = i*0.5f; });
+
+	bool ok = measure("wide", wide) & measure("deep", deep) & measure("tests", tests) & measure("cells", cells) & measure("enums", enums) &
+		measure("numbers", numbers) & measure("varints", varints) & measure("strings", strings) & measure("floats", floats) &
+		measureParallel("indexed", tests);
+	printf("\n]\n");
+	return !ok || !sink;
+}
@@ -1,4 +1,8 @@
+#include <atomic>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <binarywheel.hpp>
 #include <testtypes.hpp>
@@ -11,6 +15,20 @@ bool operator==(const EnumStruct& a, const EnumStruct& b) { return ~a == ~b; }
 bool operator==(const NumStruct& a, const NumStruct& b) { return ~a == ~b; }
 bool operator==(const TestStruct& a, const TestStruct& b) { return ~a == ~b; }
 
+// Packs its interned string with a Type of its own, out of sight of the containers the library knows.
+struct Label { bw::Interned<string> name; };
+
+template<> struct bw::Type<Label>
+{
+	static constexpr size_t fixedBytes = variable;
+	static constexpr size_t fixedBits = variable;
+	static string toString(const Label& x) { return bw::toString(x.name); }
+	static size_t bitLength(const Label& x) { return bw::bitLength(x.name); }
+	template<typename R> static Label unpack(R& r) { return {r.template unpack<bw::Interned<string>>()}; }
+	template<typename R> static void skip(R& r) { r.template skip<bw::Interned<string>>(); }
+	template<typename W> static void packInto(W& w, const Label& x) { w.pack(x.name); }
+};
+
 const TestStruct t0{};
 
 const TestStruct t1 =
@@ -81,6 +99,616 @@ const lest::test tests[] =
 		EXPECT(bw::Reader(t1b).unpack<TestStruct>() == t1);
 	},
 
+	CASE("buffer")
+	{
+		char buf[64];
+		EXPECT(bw::pack(t1, buf, sizeof(buf)) == t1b.size());
+		EXPECT(vector<char>(buf, buf + t1b.size()) == t1b);
+		EXPECT_THROWS_AS(bw::pack(t1, buf, t1b.size() - 1), std::range_error);
+	},
+
+	CASE("single pass")
+	{
+		EXPECT(bw::pack(t1, bw::singlePass) == t1b);
+		EXPECT(bw::pack(n1, bw::singlePass) == n1b);
+
+		vector<char> b = t1b;
+		bw::Writer w(b);
+		w.pack(vector<NumStruct>(1000, n1));
+		EXPECT(b.size() == t1b.size() + bw::byteLength(vector<NumStruct>(1000, n1)));
+		EXPECT(vector<char>(b.begin(), b.begin() + t1b.size()) == t1b);
+		EXPECT((bw::Reader(b.data() + t1b.size(), b.data() + b.size()).unpack<vector<NumStruct>>() == vector<NumStruct>(1000, n1)));
+
+		vector<char> grown = t1b;
+		{
+			bw::GrowingWriter g(grown);
+			g.pack(t1);
+			EXPECT(g.size() == 2*t1b.size());
+		}
+		EXPECT(grown.size() == 2*t1b.size());
+	},
+
+	CASE("views")
+	{
+		auto b = bw::pack(make_tuple("str s"s, vector<string>{"s1"s, "s2"s}));
+		auto v = bw::Reader(b).unpack<tuple<string_view, vector<bw::ByteView>>>();
+		EXPECT(get<0>(v) == "str s");
+		EXPECT(size_t(get<0>(v).data() - b.data()) < b.size());
+		EXPECT(get<1>(v).size() == 2u);
+		EXPECT(bw::toString(get<1>(v)) == "[ <7331> <7332> ]");
+		EXPECT(bw::pack(v) == b);
+	},
+
+	CASE("lazy")
+	{
+		TestStructView v(t1b);
+		EXPECT(v.s() == t1.s);
+		EXPECT(v.o4() == t1.o4);
+		EXPECT(v.f() == t1.f);
+		EXPECT(v.o7() == t1.o7);
+		EXPECT(v.unpack() == t1);
+		EXPECT(NumStructView(n1b).u32() == n1.u32);
+	},
+
+	CASE("fixed")
+	{
+		static_assert(bw::fixedBitLength<EnumStruct> == 10);
+		static_assert(bw::fixedBitLength<NumStruct> == 120);
+		static_assert(!bw::isFixed<TestStruct>);
+		EXPECT_THROWS_AS(bw::Reader(n1b.data(), n1b.data() + n1b.size() - 1).unpack<NumStruct>(), std::range_error);
+		EXPECT_THROWS_AS(bw::Reader(e1b.data(), e1b.data() + e1b.size() - 1).unpack<vector<EnumStruct>>(), std::range_error);
+	},
+
+	CASE("arrays")
+	{
+		auto x = make_tuple(true, vector<int16_t>{1, -2}, true);
+		auto b = bw::pack(x);
+		EXPECT(b == (vector<char>{9, 2, 1, 0, -2, -1}));
+		EXPECT((bw::Reader(b).unpack<decltype(x)>() == x));
+		EXPECT_THROWS_AS(bw::Reader(b.data(), b.data() + b.size() - 1).unpack<decltype(x)>(), std::range_error);
+
+		vector<bool> flags = {1, 0, 1, 1, 0, 0, 0, 0, 1};
+		EXPECT(bw::pack(flags) == (vector<char>{52, 9, 4}));
+		EXPECT((bw::unpack<vector<bool>>(bw::pack(flags)) == flags));
+	},
+
+	CASE("stream")
+	{
+		vector<NumStruct> numbers(100);
+		for(size_t i = 0; i < numbers.size(); ++i) numbers[i].i32 = int32_t(i);
+		vector<bool> flags(100, true);
+		auto b = bw::pack(forward_as_tuple(t1, numbers, flags));
+		istringstream in(string(b.begin(), b.end()));
+
+		bw::StreamReader r(in, 16);
+		EXPECT(r.unpack<TestStruct>() == t1);
+		EXPECT((r.unpack<vector<NumStruct>>() == numbers));
+		EXPECT((r.unpack<vector<bool>>() == flags));
+		EXPECT_THROWS_AS(r.unpack<uint8_t>(), std::range_error);
+
+		size_t left = t1b.size() - 1;
+		bw::StreamReader cut([&](char* dest, size_t len)
+		{
+			len = min(len, left);
+			memcpy(dest, t1b.data() + t1b.size() - 1 - left, len);
+			left -= len;
+			return len;
+		}, 3);
+		EXPECT_THROWS_AS(cut.unpack<TestStruct>(), std::range_error);
+	},
+
+	CASE("stream writer")
+	{
+		vector<string> strings(100, "str");
+		auto x = make_tuple(t1, true, strings, vector<bool>(100, true), false);
+		auto b = bw::pack(x);
+
+		ostringstream out;
+		bw::StreamWriter w(out, 8);
+		w.pack(x);
+		w.flush();
+		w.pack(t1);
+		w.flush();
+		EXPECT(out.str() == string(b.begin(), b.end()) + string(t1b.begin(), t1b.end()));
+
+		vector<char> sent;
+		bw::StreamWriter s(bw::Sink{[&](const char* src, size_t len) { sent.insert(sent.end(), src, src + len); }, nullptr}, 8);
+		s.pack(x);
+		s.flush();
+		EXPECT(sent == b);
+	},
+
+	CASE("archive")
+	{
+		ostringstream out;
+		bw::ArchiveWriter w(out, 16);
+		for(int i = 0; i < 100; ++i) w.append(i % 2 ? t1 : t0);
+		w.close();
+		string data = out.str();
+
+		auto a = bw::ArchiveReader::fromBytes(data);
+		EXPECT(a.size() == 100u);
+		EXPECT(a.unpack<TestStruct>(0) == t0);
+		EXPECT(a.unpack<TestStruct>(99) == t1);
+		EXPECT(a.at(1).size() == t1b.size());
+		EXPECT(TestStructView(a.at(51)).s() == t1.s);
+		EXPECT_THROWS_AS(a.at(100), std::out_of_range);
+		EXPECT_THROWS_AS(bw::ArchiveReader::fromBytes(string_view(data).substr(0, data.size() - 1)), std::range_error);
+
+		string path = "/tmp/binarywheel-test.bwa";
+		ofstream(path, ios::binary) << data;
+		auto mapped = bw::ArchiveReader::open(path);
+		EXPECT(mapped.unpack<TestStruct>(99) == t1);
+		vector<bw::ArchiveReader> readers;
+		readers.push_back(move(mapped));
+		EXPECT(mapped.size() == 0u);
+		optional<bw::ArchiveReader> moved(move(readers[0]));
+		readers[0] = move(*moved);
+		EXPECT(moved->size() == 0u);
+		EXPECT(readers[0].unpack<TestStruct>(99) == t1);
+		remove(path.c_str());
+		EXPECT_THROWS_AS(bw::ArchiveReader::open(path), std::system_error);
+	},
+
+	CASE("pmr")
+	{
+		using Strings = tuple<pmr::vector<pmr::string>, optional<pmr::string>, pmr::vector<int16_t>>;
+		auto b = bw::pack(make_tuple(vector<string>{"a long string, not a small one"s, "s2"s}, optional<string>("o str"s), vector<int16_t>{1, -2}));
+
+		char arena[1024];
+		pmr::monotonic_buffer_resource memory(arena, sizeof(arena), pmr::null_memory_resource());
+		bw::Reader r(b);
+		r.resource(&memory);
+		auto x = r.unpack<Strings>();
+		EXPECT(get<0>(x).get_allocator().resource() == &memory);
+		EXPECT(get<0>(x)[0].get_allocator().resource() == &memory);
+		EXPECT(get<1>(x)->get_allocator().resource() == &memory);
+		EXPECT(get<0>(x)[0] == "a long string, not a small one");
+		EXPECT(bw::pack(x) == b);
+
+		auto ib = bw::pack(bw::IndexedList<string>{"another string, not a small one"s, "s"s});
+		bw::Reader ir(ib);
+		ir.resource(&memory);
+		auto list = ir.unpack<bw::pmr::IndexedList<pmr::string>>();
+		EXPECT(list.get_allocator().resource() == &memory);
+		EXPECT(list[0].get_allocator().resource() == &memory);
+		EXPECT(bw::pack(list) == ib);
+	},
+
+	CASE("into")
+	{
+		TestStruct x = t1;
+		auto nested = x.a.data();
+		auto strings = x.o6->data();
+		bw::Reader(t1b).unpackInto(x);
+		EXPECT(x == t1);
+		EXPECT(x.a.data() == nested);
+		EXPECT(x.o6->data() == strings);
+
+		bw::unpackInto(t0b, x);
+		EXPECT(x == t0);
+		bw::unpackInto(t1b, x);
+		EXPECT(x == t1);
+		EXPECT_THROWS_AS(bw::Reader(t1b.data(), t1b.data() + t1b.size() - 1).unpackInto(x), std::range_error);
+
+		// a shorter message keeps the capacity of the list for a longer one
+		vector<string> longer(3, string(100, 'x')), shorter(1, "a"), y;
+		bw::unpackInto(bw::pack(longer), y);
+		const string* kept = y.data();
+		bw::unpackInto(bw::pack(shorter), y);
+		EXPECT(y == shorter);
+		bw::unpackInto(bw::pack(vector<string>(3, "b")), y);
+		EXPECT(y == vector<string>(3, "b"));
+		EXPECT(y.data() == kept);
+	},
+
+	CASE("try")
+	{
+		auto x = bw::Reader(t1b).tryUnpack<TestStruct>();
+		EXPECT(bool(x));
+		EXPECT(*x == t1);
+
+		for(size_t len = 0; len < t1b.size(); ++len)
+		{
+			bw::Reader r(t1b.data(), t1b.data() + len);
+			auto y = r.tryUnpack<TestStruct>();
+			EXPECT(y.error == bw::Error::truncated);
+			EXPECT(y.offset <= len);
+			EXPECT(r.size() == 0u);
+		}
+
+		vector<char> huge = {3, -1, -1, -1, -1, -1, -1, -1, 127};
+		EXPECT(bw::Reader(huge).tryUnpack<vector<string>>().error == bw::Error::truncated);
+		EXPECT(bw::Reader(huge).tryUnpack<vector<NumStruct>>().error == bw::Error::truncated);
+
+		// lists of elements taking no bits fail without throwing, however many they claim
+		vector<char> empty;
+		bw::Writer ew(empty);
+		bw::varint::packInto(ew, size_t(1) << 32);
+		EXPECT(bw::Reader(empty).tryUnpack<vector<tuple<>>>().error == bw::Error::budget);
+		using Single = bw::WithStrings<tuple<vector<bw::Interned<string>>>>;
+		vector<char> single;
+		bw::Writer sw(single);
+		bw::varint::packInto(sw, 1);
+		sw.pack(string("a"));
+		bw::varint::packInto(sw, size_t(1) << 32);
+		EXPECT(bw::Reader(single).tryUnpack<Single>().error == bw::Error::budget);
+		EXPECT(bw::Reader(single.data(), single.data() + single.size() - 1).tryUnpack<Single>().error == bw::Error::truncated);
+	},
+
+	CASE("skip")
+	{
+		auto x = make_tuple(vector<bool>(13, true), e1, true, vector<NumStruct>(3, n1), t1, vector<int16_t>{1, 2}, uint8_t(7), false, t0);
+		auto b = bw::pack(x);
+		bw::Reader r(b);
+		bw::skip<vector<bool>>(r);
+		bw::skip<vector<EnumStruct>>(r);
+		EXPECT(r.unpack<bool>() == true);
+		bw::skip<vector<NumStruct>>(r);
+		bw::skip<TestStruct>(r);
+		bw::skip<vector<int16_t>>(r);
+		EXPECT(r.unpack<uint8_t>() == 7);
+		EXPECT(r.unpack<bool>() == false);
+		bw::skip<TestStruct>(r);
+		EXPECT(r.size() == 0u);
+
+		EXPECT(bw::validate<decltype(x)>(b) == bw::Error::none);
+		EXPECT(bw::validate<TestStruct>(t1b) == bw::Error::none);
+		EXPECT(bw::validate<TestStruct>({t1b.data(), t1b.data() + t1b.size() - 1}) == bw::Error::truncated);
+		auto extra = t1b;
+		extra.push_back(0);
+		EXPECT(bw::validate<TestStruct>(extra) == bw::Error::trailing);
+	},
+
+	CASE("indexed")
+	{
+		EXPECT(bw::pack(bw::IndexedList<string>{"ab", "c"}) == (vector<char>{0, 2, 4, 0, 0, 0, 7, 0, 0, 0, 0, 2, 97, 98, 0, 1, 99}));
+
+		using Inner = tuple<bool, bw::IndexedList<bool>, string>;
+		bw::IndexedList<Inner> inner;
+		for(int i = 0; i < 50; ++i) inner.push_back({i % 2 == 0, bw::IndexedList<bool>(i % 5, true), string(i % 7, 'x')});
+		auto x = make_tuple(true, bw::IndexedList<TestStruct>{t0, t1, t1, t0}, inner, false, "s"s);
+		auto b = bw::pack(x);
+		EXPECT(b.size() == bw::byteLength(x));
+		EXPECT((bw::unpack<decltype(x)>(b) == x));
+		EXPECT(bw::validate<decltype(x)>(b) == bw::Error::none);
+
+		bw::Reader r(b);
+		EXPECT(r.unpack<bool>() == true);
+		bw::ListView<TestStruct> v(r);
+		EXPECT(v.size() == 4u);
+		EXPECT(v[2] == t1);
+		EXPECT(TestStructView(v.at(1)).s() == t1.s);
+		EXPECT_THROWS_AS(v.at(4), std::out_of_range);
+		bw::skip<bw::IndexedList<TestStruct>>(r);
+		bw::skip<bw::IndexedList<Inner>>(r);
+		EXPECT(r.unpack<bool>() == false);
+		EXPECT(r.unpack<string>() == "s");
+
+		for(bool seekable : {true, false})
+		{
+			vector<char> sent;
+			bw::Sink sink{[&](const char* src, size_t len) { sent.insert(sent.end(), src, src + len); }, nullptr};
+			if(seekable) sink.patch = [&](size_t pos, char byte) { sent[pos] = byte; };
+			bw::StreamWriter w(sink, 8);
+			w.pack(x);
+			w.flush();
+			EXPECT(sent == b);
+		}
+	},
+
+	CASE("parallel")
+	{
+		using Inner = tuple<string, bw::IndexedList<uint8_t>>;
+		bw::IndexedList<Inner> x;
+		for(int i = 0; i < 1000; ++i) x.push_back({string(i % 13, 'a' + i % 26), bw::IndexedList<uint8_t>(i % 5, uint8_t(i))});
+		auto b = bw::pack(make_tuple(true, x, false));
+
+		bw::ThreadPool pool(4, 100);
+		EXPECT(pool.size() == 4u);
+		bw::Reader r(b);
+		r.pool(&pool);
+		EXPECT(r.unpack<bool>() == true);
+		auto y = bw::IndexedList<Inner>(3);
+		r.unpackInto(y);
+		EXPECT((y == x));
+		EXPECT(r.unpack<bool>() == false);
+		EXPECT(r.size() == 0u);
+
+		b[2 + 4*500] = 0x7f;
+		bw::Reader bad(b);
+		bad.pool(&pool);
+		bad.unpack<bool>();
+		EXPECT_THROWS_AS(bad.unpack<bw::IndexedList<Inner>>(), std::range_error);
+
+		EXPECT(bw::pack(make_tuple(true, x, false), pool) == bw::pack(make_tuple(true, x, false)));
+		vector<char> grown;
+		{
+			bw::Writer w(grown);
+			w.pool(&pool);
+			w.pack(make_tuple(true, x, false));
+		}
+		EXPECT(grown == bw::pack(make_tuple(true, x, false)));
+		for(bool seekable : {true, false})
+		{
+			vector<char> sent;
+			bw::Sink sink{[&](const char* src, size_t len) { sent.insert(sent.end(), src, src + len); }, nullptr};
+			if(seekable) sink.patch = [&](size_t pos, char byte) { sent[pos] = byte; };
+			bw::StreamWriter w(sink, 64);
+			w.pool(&pool);
+			w.pack(make_tuple(true, x, false));
+			w.flush();
+			EXPECT(sent == bw::pack(make_tuple(true, x, false)));
+		}
+
+		std::atomic<size_t> calls = 0;
+		EXPECT_THROWS_AS(pool.run(50, [&](size_t i) { ++calls; if(i == 10) throw std::out_of_range("i"); }), std::out_of_range);
+		EXPECT(calls <= 50u);
+		pool.run(50, [&](size_t) { ++calls; });
+		EXPECT(calls >= 50u);
+	},
+
+	CASE("delta")
+	{
+		EXPECT(bw::packDelta(t1, t1) == (vector<char>{0, 0}));
+		TestStruct x = t1;
+		x.s = "changed";
+		x.a[1].x = 9;
+		x.a.push_back(x.a[0]);
+		x.o7->c = !x.o7->c;
+		auto d = bw::packDelta(t1, x);
+		EXPECT(d.size() < bw::pack(x).size()/2);
+		for(const auto& [from, to] : {make_pair(t1, x), make_pair(x, t1), make_pair(t0, t1), make_pair(t1, t0)})
+		{
+			TestStruct y = from;
+			bw::applyDelta(y, bw::packDelta(from, to));
+			EXPECT(y == to);
+		}
+
+		NumStruct n{1, 2, 3, 4, 0.5f, 0.25f}, m = n;
+		m.u32 = 5;
+		bw::applyDelta(n, bw::packDelta(n, m));
+		EXPECT(~n == ~m);
+		EXPECT_THROWS_AS(bw::applyDelta(n, vector<char>{1}), std::range_error);
+	},
+
+	CASE("leb128")
+	{
+		EXPECT(bw::pack(bw::Var<uint32_t>(0)) == (vector<char>{0}));
+		EXPECT(bw::pack(bw::Var<uint32_t>(300)) == (vector<char>{char(0xac), 2}));
+		EXPECT(bw::pack(bw::Var<int32_t>(-1)) == (vector<char>{1}));
+		EXPECT(bw::pack(bw::Var<int32_t>(-65)) == (vector<char>{char(0x81), 1}));
+		EXPECT(bw::pack(bw::Var<uint64_t>(~0ull)).size() == 10u);
+		EXPECT(bw::toString(bw::Var<int16_t>(-5)) == "-5");
+
+		vector<bw::Var<int64_t>> x;
+		for(int s = 0; s < 64; ++s) for(uint64_t v : {uint64_t(1) << s, 0 - (uint64_t(1) << s), (uint64_t(1) << s) - 1, (uint64_t(1) << s) + 3}) x.push_back(int64_t(v));
+		x.push_back(numeric_limits<int64_t>::max());
+		auto t = make_tuple(true, x, vector<bw::Var<uint8_t>>{1, 200, 255}, bw::Var<uint64_t>(~0ull));
+		auto b = bw::pack(t);
+		EXPECT(b.size() == bw::byteLength(t));
+		EXPECT((bw::unpack<decltype(t)>(b) == t));
+		EXPECT(bw::validate<decltype(t)>(b) == bw::Error::none);
+		bw::Reader r(b);
+		bw::skip<bool>(r);
+		bw::skip<vector<bw::Var<int64_t>>>(r);
+		EXPECT((r.unpack<vector<bw::Var<uint8_t>>>() == vector<bw::Var<uint8_t>>{1, 200, 255}));
+		for(size_t i = 0; i < b.size(); ++i) EXPECT(!bw::Reader(b.data(), b.data() + i).tryUnpack<decltype(t)>());
+
+		istringstream in(string(b.begin(), b.end()));
+		bw::StreamReader s(in, 16);
+		EXPECT((s.unpack<decltype(t)>() == t));
+	},
+
+	CASE("bit integers")
+	{
+		auto x = make_tuple(bw::UInt<10>(1023), bw::Int<12>(-2048), true);
+		EXPECT(bw::pack(x) == (vector<char>{char(0xff), 3, 0x60}));
+		EXPECT((bw::unpack<decltype(x)>(bw::pack(x)) == x));
+		EXPECT(sizeof(bw::UInt<8>) == 1u);
+		EXPECT(sizeof(bw::Int<9>) == 2u);
+		EXPECT(bw::toString(bw::Int<5>(-3)) == "-3");
+		EXPECT_THROWS_AS(bw::pack(bw::UInt<10>(1024)), std::range_error);
+		EXPECT_THROWS_AS(bw::pack(bw::Int<12>(2048)), std::range_error);
+		EXPECT_THROWS_AS(bw::pack(bw::Int<12>(-2049)), std::range_error);
+		EXPECT(bw::unpack<bw::UInt<32>>(bw::pack(bw::UInt<32>(~0u))) == ~0u);
+		EXPECT(bw::unpack<bw::Int<32>>(bw::pack(bw::Int<32>(numeric_limits<int32_t>::min()))) == numeric_limits<int32_t>::min());
+
+		vector<tuple<bw::UInt<3>, bw::Int<4>>> list;
+		vector<bw::Int<12>> ints;
+		for(int i = 0; i < 1000; ++i)
+		{
+			list.push_back({i % 8, i % 16 - 8});
+			ints.push_back(i % 4096 - 2048);
+		}
+		auto b = bw::pack(make_tuple(list, ints));
+		EXPECT(b.size() == 2u*2 + (2*2 + 1000*7 + 1000*12 + 7)/8);
+		EXPECT((bw::unpack<tuple<decltype(list), decltype(ints)>>(b) == make_tuple(list, ints)));
+		list[500] = {0, 8};
+		EXPECT_THROWS_AS(bw::pack(list), std::range_error);
+	},
+
+	CASE("interned")
+	{
+		using Entry = tuple<bw::Interned<string>, bool, optional<bw::Interned<string>>>;
+		using Message = bw::WithStrings<tuple<vector<Entry>, bw::Interned<string>>>;
+		Message x;
+		for(int i = 0; i < 100; ++i) get<0>(x).push_back({"host " + to_string(i % 3), i % 2, i % 5 ? optional<bw::Interned<string>>("metric") : nullopt});
+		get<1>(x) = "host 1";
+		auto b = bw::pack(x);
+		EXPECT(b.size() == bw::byteLength(x));
+		EXPECT(b.size() < bw::pack(static_cast<const tuple<vector<Entry>, bw::Interned<string>>&>(x)).size()/5);
+		EXPECT((bw::unpack<Message>(b) == x));
+		EXPECT(bw::validate<Message>(b) == bw::Error::none);
+
+		auto views = bw::unpack<bw::WithStrings<tuple<vector<tuple<bw::Interned<string_view>, bool, optional<bw::Interned<string_view>>>>, bw::Interned<string_view>>>>(b);
+		EXPECT(get<0>(get<0>(views)[3]) == "host 0");
+		EXPECT(get<0>(get<0>(views)[0]).data() == get<0>(get<0>(views)[3]).data());
+
+		istringstream in(string(b.begin(), b.end()));
+		bw::StreamReader s(in, 16);
+		EXPECT((s.unpack<Message>() == x));
+		istringstream again(string(b.begin(), b.end()));
+		bw::StreamReader sv(again, 16);
+		EXPECT_THROWS_AS(sv.unpack<decltype(views)>(), std::range_error);
+
+		EXPECT(bw::pack(bw::WithStrings<tuple<bw::Interned<string>, bw::Interned<string>>>(make_tuple("a", "a"))) == (vector<char>{0, 1, 1, 97}));
+		using Indexed = bw::WithStrings<tuple<bw::IndexedList<bw::Interned<string>>, bw::Interned<string>>>;
+		Indexed y(make_tuple(bw::IndexedList<bw::Interned<string>>{"x", "yy"}, "x"));
+		EXPECT((bw::unpack<Indexed>(bw::pack(y)) == y));
+		EXPECT(bw::pack(y).size() == bw::byteLength(y));
+
+		using Labels = bw::WithStrings<tuple<vector<Label>, bw::Interned<string>>>;
+		Labels l(make_tuple(vector<Label>{{"p"}, {"q"}, {"p"}}, "q"));
+		auto lb = bw::pack(l);
+		EXPECT(lb.size() == bw::byteLength(l));
+		EXPECT((lb == bw::pack(bw::WithStrings<tuple<vector<bw::Interned<string>>, bw::Interned<string>>>(make_tuple(vector<bw::Interned<string>>{"p", "q", "p"}, "q")))));
+		EXPECT(get<0>(bw::unpack<Labels>(lb))[1].name == "q");
+
+		using Three = bw::WithStrings<tuple<bw::Interned<string>, bw::Interned<string>, bw::Interned<string>>>;
+		auto bad = bw::pack(Three(make_tuple("a", "b", "c")));
+		EXPECT(bad.back() == 0x24);
+		bad.back() = 0x3f;
+		EXPECT(bw::Reader(bad).tryUnpack<Three>().error == bw::Error::invalid);
+		EXPECT_THROWS_AS(bw::unpack<Three>(bad), std::range_error);
+
+		// every index into a table of two strings takes a bit, which bounds how many a list holds
+		vector<char> indices;
+		bw::Writer iw(indices);
+		bw::varint::packInto(iw, 2);
+		iw.pack(string("a"));
+		iw.pack(string("b"));
+		bw::varint::packInto(iw, size_t(1) << 32);
+		EXPECT(bw::Reader(indices).tryUnpack<bw::WithStrings<tuple<vector<bw::Interned<string>>>>>().error == bw::Error::truncated);
+	},
+
+	CASE("compression")
+	{
+		vector<TestStruct> x(200, t1);
+		auto packed = bw::pack(x);
+		auto b = bw::pack(x, bw::compressed);
+		EXPECT(b.size() < packed.size()/10);
+		EXPECT(bw::decompress({b.data(), b.size()}) == packed);
+		EXPECT((bw::unpack<vector<TestStruct>>(b, bw::compressed) == x));
+		EXPECT(bw::pack(t1, bw::Compression{1 << 20}).size() == t1b.size() + bw::frameHeader);
+		EXPECT(bw::unpack<TestStruct>(bw::pack(t1, bw::Compression{1 << 20}), bw::compressed) == t1);
+		EXPECT(!bw::isBorrowed<TestStruct>);
+		EXPECT((bw::isBorrowed<bw::WithStrings<tuple<vector<bw::Interned<string_view>>>>>));
+		EXPECT((bw::isBorrowed<tuple<bool, optional<bw::IndexedList<bw::ByteView>>>>));
+
+		string large(5 << 20, 'a');
+		for(size_t i = 0; i < large.size(); i += 1000) large[i] = char(i);
+		EXPECT(bw::decompress(string_view(bw::compress(large).data(), bw::compress(large).size())) == vector<char>(large.begin(), large.end()));
+
+		for(size_t i : {0, 3, 5, 9})
+		{
+			auto bad = b;
+			bad[i] ^= 0x40;
+			EXPECT_THROWS_AS(bw::unpack<vector<TestStruct>>(bad, bw::compressed), std::range_error);
+		}
+		EXPECT_THROWS_AS(bw::decompress({b.data(), b.size() - 1}), std::range_error);
+
+		ostringstream out;
+		bw::StreamWriter w(bw::compressing([&](const char* src, size_t len) { out.write(src, len); }), 4096);
+		w.pack(x);
+		w.flush();
+		string frames = out.str();
+		EXPECT(frames.size() < packed.size()/4);
+		istringstream in(frames);
+		bw::StreamReader r(bw::decompressing([&](char* dest, size_t len) { return size_t(in.read(dest, len).gcount()); }), 100);
+		EXPECT((r.unpack<vector<TestStruct>>() == x));
+		EXPECT_THROWS_AS(r.unpack<uint8_t>(), std::range_error);
+	},
+
+	CASE("budget")
+	{
+		vector<char> huge = {2, 0, 0, 0, 0x40};
+		EXPECT(bw::Reader(huge).tryUnpack<vector<string>>().error == bw::Error::truncated);
+		EXPECT(bw::Reader(huge).tryUnpack<vector<uint32_t>>().error == bw::Error::truncated);
+		EXPECT_THROWS_AS(bw::unpack<vector<optional<bool>>>(huge), std::range_error);
+
+		vector<string> strings(1000, "str");
+		auto b = bw::pack(strings);
+		auto y = bw::unpack<vector<string>>(b);
+		EXPECT(y == strings);
+		EXPECT(y.capacity() == 1000u);
+
+		size_t needed = 1000*(sizeof(string) + 3);
+		bw::Reader r(b);
+		r.budget(needed);
+		EXPECT(r.unpack<vector<string>>() == strings);
+		EXPECT(r.budget() == 0u);
+		bw::Reader tight(b);
+		tight.budget(needed - 1);
+		EXPECT(tight.tryUnpack<vector<string>>().error == bw::Error::budget);
+		tight.budget(needed - 1);
+		EXPECT_THROWS_AS(bw::Reader(tight).unpack<vector<string>>(), std::range_error);
+
+		istringstream in(string(b.begin(), b.end()));
+		bw::StreamReader s(in, 16);
+		s.budget(1000*sizeof(string));
+		EXPECT_THROWS_AS(s.unpack<vector<string>>(), std::range_error);
+
+		using Inner = tuple<string, bw::IndexedList<uint8_t>>;
+		bw::IndexedList<Inner> x;
+		for(int i = 0; i < 1000; ++i) x.push_back({string(i % 13, 'a'), bw::IndexedList<uint8_t>(i % 5, uint8_t(i))});
+		b = bw::pack(x);
+		bw::Reader one(b);
+		one.budget(1 << 20);
+		EXPECT((one.unpack<bw::IndexedList<Inner>>() == x));
+		bw::ThreadPool pool(4, 100);
+		bw::Reader many(b);
+		many.pool(&pool);
+		many.budget(1 << 20);
+		EXPECT((many.unpack<bw::IndexedList<Inner>>() == x));
+		EXPECT(many.budget() == one.budget());
+		many = bw::Reader(b);
+		many.pool(&pool);
+		many.budget((1 << 20) - one.budget() - 1);
+		EXPECT_THROWS_AS(many.unpack<bw::IndexedList<Inner>>(), std::range_error);
+
+		// chunks share the budget, a skewed list unpacks with just what it needs as it does sequentially
+		bw::IndexedList<string> skewed(1000);
+		for(int i = 0; i < 10; ++i) skewed[i] = string(1000, 'a');
+		b = bw::pack(skewed);
+		one = bw::Reader(b);
+		one.budget(1 << 20);
+		one.unpack<bw::IndexedList<string>>();
+		many = bw::Reader(b);
+		many.pool(&pool);
+		many.budget((1 << 20) - one.budget());
+		EXPECT((many.unpack<bw::IndexedList<string>>() == skewed));
+		EXPECT(many.budget() == 0u);
+
+		vector<char> count, lists;
+		bw::Writer c(count), w(lists);
+		bw::varint::packInto(c, size_t(1) << 40);
+		bw::varint::packInto(w, 2);
+		w.pack(uint32_t(count.size()));
+		w.pack(uint32_t(2*count.size()));
+		for(int i = 0; i < 2; ++i) w.write(count.data(), count.size());
+		bw::ThreadPool any(2, 1);
+		bw::Reader unlimited(lists);
+		unlimited.pool(&any);
+		EXPECT_THROWS_AS(unlimited.unpack<bw::IndexedList<vector<bw::Interned<string>>>>(), std::range_error);
+		EXPECT(!unlimited.budgeted());
+
+		// nothing in the range bounds lists of elements that take no bits, so without a budget they're limited
+		vector<char> single;
+		bw::Writer sw(single);
+		bw::varint::packInto(sw, 1);
+		sw.pack(string("a"));
+		bw::varint::packInto(sw, size_t(1) << 32);
+		using Single = bw::WithStrings<tuple<vector<bw::Interned<string>>>>;
+		EXPECT_THROWS_AS(bw::unpack<Single>(single), std::range_error);
+		vector<char> empty;
+		bw::Writer ew(empty);
+		bw::varint::packInto(ew, size_t(1) << 32);
+		EXPECT_THROWS_AS(bw::unpack<vector<tuple<>>>(empty), std::range_error);
+		Single ones(make_tuple(vector<bw::Interned<string>>(1000, "a")));
+		EXPECT((bw::unpack<Single>(bw::pack(ones)) == ones));
+	},
+
 	CASE("other")
 	{
 		EXPECT(bw::Reader(bw::pack(t0)).unpack<TestStruct>() == t0);